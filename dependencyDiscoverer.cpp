@@ -5,11 +5,14 @@
  * 
  * This is my own work as defined in the Academic Ethics Agreement I have signed.
  * 
- * usage: ./dependencyDiscoverer [-Idir] ... file.c|file.l|file.y ...
+ * usage: ./dependencyDiscoverer [option] ... [-Idir] ... file.c|file.l|file.y|file.cpp|file.S|file.proto ...
  *
- * processes the c/yacc/lex source file arguments, outputting the dependencies
- * between the corresponding .o file, the .c source file, and any included
- * .h files
+ * any argument of the form @file is replaced by the arguments listed in
+ * file, separated by whitespace (quotes and '\' work as in the shell)
+ *
+ * processes the c/yacc/lex (and other, see below) source file arguments,
+ * outputting the dependencies between the corresponding .o file, the .c
+ * source file, and any included .h files
  *
  * each .h file is also processed to yield a dependency between it and any
  * included .h files
@@ -22,6 +25,26 @@
  *
  * note that system includes (i.e. those in angle brackets) are NOT processed
  *
+ * each file is read by the scanner registered for its extension, and all of
+ * them share one crawl, search path and set of caches:
+ *
+ *      .c .y .l .cc .cpp .cxx .C   #include "x.h" lines; target foo.o
+ *      .S .s                       .include "x.inc" and #include "x.h"
+ *                                  lines; target foo.o
+ *      .inc                        as .S, but not a target
+ *      .proto                      import "x.proto"; lines (including
+ *                                  public and weak ones); target foo.pb.o
+ *
+ * files with any other extension, such as headers, are scanned as C
+ *
+ * built with -DMAKE_PLUGIN (make dependencyDiscoverer.so), this file is
+ * instead a GNU make plugin adding a $(deps files[,-Idir ...]) function,
+ * which crawls in make's own process and keeps what it has scanned for
+ * later calls in the same make run; its errors stop make as $(error) does:
+ *
+ *      load ./dependencyDiscoverer.so
+ *      foo.o: $(deps foo.c,-Iinc)
+ *
  * dependencyDiscoverer uses the CPATH environment variable, which can contain a
  * set of directories separated by ':' to find included files
  * if any additional directories are specified in the command line,
@@ -37,6 +60,216 @@
  *      foo/bar/include/x.h
  *      /home/user/include/x.h
  *      /usr/local/group/include/x.h
+ *
+ * the number of crawler threads is taken from the CRAWLER_THREADS environment
+ * variable (2 if unset); when run from a parallel GNU make whose MAKEFLAGS
+ * name a jobserver, every thread beyond the first runs only while holding a
+ * jobserver token, so the crawl stays within the build's -j budget (and the
+ * default is raised to the number of CPUs)
+ *
+ * options
+ * =======
+ *
+ * --stats
+ *      write the number of files crawled (and of those, found in a scan
+ *      cache, rescanned under --tiered, and found to be copies under
+ *      --dedup, with the bytes not scanned as a result), the number of
+ *      targets imported from .d files, the bytes read, the time taken to crawl and the throughput,
+ *      and the wall time spent backing off under --background, to standard
+ *      error on exit, e.g.
+ *
+ *           stats: files=146 cached=0 imported=0 precise=0 deduped=0 saved=0 bytes=9512 crawl=0.004s files/s=36500 MB/s=2.38 yielded=0ms
+ *
+ * --background[=reads]
+ *      run as a background indexer: lower the CPU priority (nice 19 and
+ *      SCHED_IDLE) and I/O priority (idle class), read at most reads files
+ *      at once (default 2), and pause crawling while /proc/pressure shows
+ *      more than 10% of the last 10s stalled on CPU or I/O
+ *
+ * --memory-report
+ *      the number of bytes held by each of the major data structures (file
+ *      name strings, the dependency table, the edge lists, the work queue,
+ *      the per-target closure structures and the output buffer) is tracked
+ *      while running; the final and peak values are written to standard
+ *      error on exit, one line per structure, e.g.
+ *
+ *           memory: table final=4352 peak=4352
+ *
+ * --deadline=ms
+ *      stop crawling and printing once ms milliseconds have elapsed since
+ *      start up; the crawl can also be cancelled at any time by sending the
+ *      process SIGUSR1.  in either case the dependencies gathered so far are
+ *      printed, followed by the line
+ *
+ *           # incomplete
+ *
+ *      and the exit status is 2
+ *
+ * --files-from=list
+ *      add the files named in list ('-' for standard input), separated by
+ *      newlines or NUL characters, after any file arguments; they are
+ *      crawled as soon as they are read, so the list may be streamed
+ *
+ * --compress=gzip|zstd
+ *      compress standard output; it is cut into 1MB chunks that are
+ *      compressed in parallel (by CRAWLER_THREADS threads) into independent
+ *      gzip members or zstd frames, which gunzip and zstd -d read back as
+ *      one stream.  zstd is only available if zstd.h was found at build time
+ *
+ * --dedup
+ *      read each file whole and hash its contents; a file with the same
+ *      contents (and size) as one already scanned, such as a vendored copy
+ *      of a header, takes the names that one includes without being
+ *      scanned (the names are still looked up in the search path and
+ *      added as a scan would add them).  --stats gives the bytes of
+ *      scanning saved
+ *
+ * --tiered
+ *      files in which an include follows a conditional (#if, #ifdef,
+ *      #ifndef other than an include guard, #elif, #else) or a block
+ *      comment spanning lines, or is spelt with spaces after the '#', are
+ *      scanned again by a precise lexer that skips
+ *      comments and literals and drops includes in #if 0 branches; the
+ *      number of files that needed it is given by --stats.  the scan
+ *      caches keep the results of tiered and untiered scans apart
+ *
+ * --import-deps=file.d
+ *      (may be repeated) seed the graph from make rules written by the
+ *      compiler's -MD: a target whose rule in file.d lists only files that
+ *      exist and are no newer than file.d gets the dependencies listed (as
+ *      found on the search path; others are dropped as system headers)
+ *      and is not scanned.  the files it depends on are only scanned if a
+ *      scanned file includes them, and targets with stale rules are
+ *      scanned as usual.  a rule's source must be named as the target
+ *      argument is (a leading "./" aside).  an imported target lists its
+ *      dependencies in the order of file.d rather than the order a scan
+ *      finds them in, so the two can differ in order, though not in the
+ *      files listed
+ *
+ * --shm-cache=/name[,mb]
+ *      share scan results with every other process using the POSIX shared
+ *      memory segment /name (created with mb megabytes, default 64, by the
+ *      first process to use it): a file whose device, inode, size and
+ *      modification times are unchanged is not read again.  remove the
+ *      segment with rm /dev/shm/name
+ *
+ * --cache=file
+ *      keep scan results between runs in file, an append-only journal that
+ *      is replayed at start up (see struct ScanJournal); only files whose
+ *      device, inode, size or modification times changed are read again
+ *      and appended, and the journal is compacted in the background once
+ *      most of its records are stale
+ *
+ * --snapshot=file
+ *      after crawling, also write the dependency graph to file in a compact
+ *      binary form (see struct Snapshot)
+ *
+ * --diff=old[,new]
+ *      instead of printing dependencies, compare the snapshot old with the
+ *      snapshot new, or with the graph just crawled from the file arguments
+ *      if new is not given; for each file whose direct dependencies differ,
+ *      and for each target whose transitive dependencies differ, a line
+ *      lists the added (+) and removed (-) files, e.g.
+ *
+ *           edges inc1.h: +inc4.h -inc3.h
+ *           closure foo.o: +inc4.h -inc3.h
+ *
+ *      the exit status is 0 if there are no differences and 1 otherwise
+ *
+ * --load=file
+ *      use the snapshot in file for --diff or --rebuild-cost instead of
+ *      crawling; no file arguments are needed
+ *
+ * --rebuild-cost=changes
+ *      instead of printing dependencies, read a list of changed files (one
+ *      per line, '-' for standard input) and estimate the cost of the
+ *      rebuild they trigger: the sum of the cost of every target that
+ *      depends on a changed file, followed by the ten changed files with
+ *      the highest cost on their own, e.g.
+ *
+ *           rebuild: cost 35210 over 23 of 89 targets
+ *           changed inc1.h: cost 30211 over 20 targets
+ *
+ *      a target's cost is the number of bytes in it and its transitive
+ *      dependencies, unless --cost-weights is given
+ *
+ * --cost-weights=file.csv
+ *      take target costs (e.g. historical compile times) from lines of the
+ *      form "foo.o,cost" or "foo.c,cost"; targets not listed cost 0
+ *
+ * --memory-budget=mb
+ *      once the tracked size of the data structures (see --memory-report)
+ *      exceeds mb megabytes, move the dependency lists of scanned files to a
+ *      temporary file; it is memory mapped when printing, and its pages are
+ *      dropped after each partition of 256 targets.  only these lists
+ *      spill, so the budget is a target, not a bound: the interned file
+ *      names and the table's entries stay in memory however large they
+ *      grow, and the tracked size exceeds mb once they alone do, as do
+ *      the snapshots for --diff and --rebuild-cost
+ *
+ * --huge-pages=off|thp|hugetlb
+ *      back allocations of 2MB or more (the dependency table's buckets and
+ *      the arrays of snapshots, diffs and rebuild costs) with transparent
+ *      huge pages, or with explicit huge pages when reserved through
+ *      /proc/sys/vm/nr_hugepages (falling back to transparent ones); this
+ *      cuts TLB misses when walking graphs with millions of files.  see
+ *      hugepage_test.sh for a comparison of the modes
+ *
+ * --hash-report
+ *      after crawling, write the throughput (ns per name) and bucket
+ *      distribution quality of std::hash and of pathHash, the hash stored
+ *      with every file name, over the names found, e.g.
+ *
+ *           hash: pathHash ns/key=4.10 quality=1.002 maxbucket=5 collisions64=0
+ *
+ *      to standard error
+ *
+ * --audit=n
+ *      after crawling, run the compiler ($CC, or cc if unset) with -MM and
+ *      the -I directories on n of the .c targets, spread evenly, with
+ *      CRAWLER_THREADS at once, and compare the dependencies it lists (on
+ *      the search path) with those found here; write a line for each
+ *      target that differs, listing files missed (-) and files the
+ *      compiler didn't list (+), then a summary comparing the time per
+ *      target of both, e.g.
+ *
+ *           audit foo.o: -config.h +unused.h
+ *           audit: 49 of 50 targets match (0 failed to compile) missing=1 extra=1 scanner ms/target=0.021 compiler ms/target=9.800 speedup=466.7x
+ *
+ *      to standard error
+ *
+ * --intern-report
+ *      after crawling, write the time per operation of interning the names
+ *      found from 1 to 64 threads at once, with the lock free interner that
+ *      gives every file name its ID and with a mutex protected
+ *      unordered_map, e.g.
+ *
+ *           intern: threads=8 interner ns/op=21.30 mutex-map ns/op=180.52
+ *
+ *      to standard error
+ *
+ * --closure-report
+ *      after crawling, write the bytes taken and the time to build and to
+ *      iterate the transitive closures of the targets, kept as a sorted ID
+ *      vector per target, as a sorted ID vector per include cycle (or
+ *      file) built from those of the files it includes, and likewise as a
+ *      roaring-style compressed bitmap, which --diff uses, e.g.
+ *
+ *           closure: roaring sets=146 bytes=61604 build ms=0.12 iterate ms=0.01 ids=263
+ *
+ *      to standard error; a way that would take more than 512MB (as the
+ *      vectors do on a deep include chain) is skipped and reported so
+ *
+ * --width-report
+ *      after crawling, freeze the graph (as --rebuild-cost does, with the
+ *      narrowest file IDs that hold it) with 16 bit IDs when it has fewer
+ *      than 65535 files and edges, and with 32 and 64 bit IDs, and write
+ *      the bytes each takes and the time to walk the closure of every
+ *      target and the reverse closure of up to 10000 files, e.g.
+ *
+ *           width: bits=16 bytes=4904 closure ms=0.05 ids=761 reverse ms=0.04 ids=563
+ *
+ *      to standard error
  */
 
 /*
@@ -44,70 +277,150 @@
    * ========================
    * There are three globally accessible variables:
    * - dirs: a vector storing the directories to search for headers
-   * - theTable: a hash table mapping file names to a list of dependent file names
+   * - theTable: a hash table mapping file names to a list of dependent file IDs
    * - workQ: a list of file names that have to be processed
+   * - nameInterner: gives each file name in theTable an ID; interning is how
+   *   a crawler thread finds that a name is new, without taking a lock when
+   *   it isn't.  it stores each name once, prefix compressed in a trie of
+   *   directories, and writes it out by ID
    *
    * 1. look up CPATH in environment
    * 2. assemble dirs vector from ".", any -Idir flags, and fields in CPATH
    *    (if it is defined)
    * 3. for each file argument (after -Idir flags)
-   *    a. insert mapping from file.o to file.ext (where ext is c, y, or l) into
+   *    a. insert mapping from file.o (the target registered for ext) to
+   *       file.ext (where ext is that of a source, e.g. c, y, or l) into
    *       table
-   *    b. insert mapping from file.ext to empty list into table
-   *    c. append file.ext on workQ
+   *    b. insert mapping from file.ext to empty list into table (or, if an
+   *       --import-deps file has a fresh rule for it, to the dependencies
+   *       listed, and skip c)
+   *    c. append file.ext on workQ (unless it was already interned, by an
+   *       earlier argument or as an include of a file being crawled)
+   *    d. the same is done by a reader thread for each file named by
+   *       --files-from, while the workQ is held open for step 4
    * 4. for each file on the workQ
-   *    a. lookup list of dependencies
-   *    b. invoke process(name, list_of_dependencies)
+   *    a. if running under a make jobserver, threads other than the first
+   *       acquire a token; under --background, wait while the machine is
+   *       loaded
+   *    b. lookup list of dependencies
+   *    c. invoke process(name, list_of_dependencies)
+   *    d. if over the --memory-budget, spill scanned lists to spillFile
+   *    e. release any jobserver token once the workQ is drained: empty,
+   *       closed, and with no file still being processed that could add
+   *       to it
    * 5. for each file argument (after -Idir flags)
-   *    a. create a hash table in which to track file names already printed
-   *    b. create a linked list to track dependencies yet to print
-   *    c. print "foo.o:", insert "foo.o" into hash table
-   *       and append "foo.o" to linked list
+   *    a. advance the epoch of the printed array, in which a file ID is
+   *       stamped with the epoch once printed for this target
+   *    b. empty the frontier vector of dependencies yet to print
+   *    c. print "foo.o:", stamp "foo.o" in printed
+   *       and append "foo.o" to the frontier
    *    d. invoke printDependencies()
+   *    printed and the frontier are allocated once and reused by every target
    *
    * general design for process()
    * ============================
    *
+   * 0. if the file's stat signature is in the shared memory cache or the
+   *    cache journal, record each name cached for it as in 4 below and
+   *    return
    * 1. open the file
-   * 2. for each line of the file
+   *    a. with --dedup, read it whole; if a file with the same contents
+   *       was scanned, record its names as in 4 below and return
+   * 2. with the scanner registered for the file's extension (scanC() for C,
+   *    shown here), for each line of the file
    *    a. skip leading whitespace
    *    b. if match "#include"
    *       i. skip leading whitespace
    *       ii. if next character is '"'
    *           * collect remaining characters of file name (up to '"')
-   *           * append file name to dependency list for this open file
-   *           * if file name not already in the master Table
-   *             - insert mapping from file name to empty list in master table
-   *             - append file name to workQ
+   *    c. with --tiered, if an include followed a conditional or block
+   *       comment, rescan the file with preciseScan()
    * 3. close file
+   * 4. for each file name collected (in addDependency())
+   *    * append file name to dependency list for this open file
+   *    * if file name not already in the master Table
+   *      - insert mapping from file name to empty list in master table
+   *      - append file name to workQ
+   *    and add the names to the shared memory cache and cache journal
    *
    * general design for printDependencies()
    * ======================================
    *
-   * 1. while there is still a file in the toProcess linked list
-   * 2. fetch next file from toProcess
+   * 1. while there is still a file in the frontier not yet walked
+   * 2. fetch next file from the frontier
    * 3. lookup up the file in the master table, yielding the linked list of dependencies
    * 4. iterate over dependenceies
-   *    a. if the filename is already in the printed hash table, continue
+   *    a. if the file is already stamped with this epoch in printed, continue
    *    b. print the filename
-   *    c. insert into printed
-   *    d. append to toProcess
+   *    c. stamp it in printed
+   *    d. append to the frontier
    *
    * Additional helper functions
    * ===========================
    *
    * dirName() - appends trailing '/' if needed
    * parseFile() - breaks up filename into root and extension
+   * scanners   - the ScannerRegistry, mapping each extension to the Scanner that finds the
+   *               names its files include, and source extensions to their target suffix
    * openFile()  - attempts to open a filename using the search path defined by the dirs vector.
+   * pathHash()  - 64 bit hash of a file name; it is computed once, when the name is scanned,
+   *               and kept with the name in a PathKey, which every hash table uses as its key
+   *
+   * Memory accounting
+   * =================
+   *
+   * memTracker holds a current and peak byte count per MemCategory; the
+   * structures above call add()/sub() as they grow and shrink.  Byte counts
+   * are estimates of the heap footprint: node and bucket sizes of the
+   * standard containers plus out-of-line string storage.  When
+   * --memory-report is not given, add()/sub() return immediately.
+   *
+   * Snapshots and diffs
+   * ===================
+   *
+   * buildSnapshot() converts theTable into a Snapshot: file names sorted so
+   * that a file's ID is its rank, with each file's dependencies as a sorted
+   * range of IDs.  diffSnapshots() merges the two sorted name lists into a
+   * union ID space; because the maps into it are monotonic, the remapped
+   * edge lists and closures stay sorted and are compared by linear merges.
+   * printRebuildCost() freezes the graph into a FrozenGraph with 16 bit
+   * IDs when it has fewer than 65535 files and edges (32 bit otherwise) and
+   * walks its reverse edges from the changed files, using one
+   * epoch-stamped visited array for the combined and per-file walks.
    */
 
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <sched.h>
 #include <semaphore.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef MAKE_PLUGIN
+extern "C" {
+#include <gnumake.h>
+}
+#endif
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstdint>
+#include <functional>
 #include <list>
 #include <mutex>
 #include <string>
@@ -116,6 +429,24 @@
 #include <unordered_set>
 #include <vector>
 
+// with -DSTRESS_DELAYS (see stress_test.sh), sleep for a random 0 to
+// CRAWLER_JITTER_US microseconds (or just yield, when it is 0 or unset) at
+// the points where the crawler threads hand files to each other, to shake
+// out orderings that are rare on an idle machine
+#ifdef STRESS_DELAYS
+static void stressDelay() {
+    static const long jitter = getenv("CRAWLER_JITTER_US") ? atol(getenv("CRAWLER_JITTER_US")) : 0;
+    thread_local unsigned int seed = std::hash<std::thread::id>()(std::this_thread::get_id());
+    if (jitter <= 0 || rand_r(&seed) % 2 == 0) {
+        sched_yield();
+    } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(rand_r(&seed) % (jitter + 1)));
+    }
+}
+#else
+static inline void stressDelay() {}
+#endif
+
 // thread safe thread tracker
 struct ThreadTracker {
    private:
@@ -144,302 +475,4366 @@ struct ThreadTracker {
     }
 };
 
-// thread safe queue
-struct QueueSafe {
+// thread safe cancellation token, checked by the crawler threads between
+// files and by main() between targets
+struct CancelToken {
    private:
-    std::list<std::string> q;
-    std::mutex mutex;
+    std::atomic<bool> cancelled{false};
+    bool hasDeadline = false;
+    std::chrono::steady_clock::time_point deadline;
 
    public:
-    void push_back(std::string string) {
-        std::unique_lock<std::mutex> lock(mutex);
-        this->q.push_back(string);
-    }
-
-    std::string pop_front() {
-        std::unique_lock<std::mutex> lock(mutex);
-        if (this->q.empty() == true) {
-            return std::string("");
-        } else {
-            std::string s = this->q.front();
-            this->q.pop_front();
-            return s;
-        }
+    void setDeadline(long ms) {
+        this->hasDeadline = true;
+        this->deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
     }
 
-    std::size_t size() {
-        std::unique_lock<std::mutex> lock(mutex);
-        return this->q.size();
+    // async-signal-safe
+    void cancel() {
+        this->cancelled.store(true, std::memory_order_relaxed);
     }
 
-    std::string front() {
-        std::unique_lock<std::mutex> lock(mutex);
-        if (this->q.empty() == true) {
-            return std::string("");
-        } else {
-            return this->q.front();
+    bool isCancelled() {
+        if (this->cancelled.load(std::memory_order_relaxed)) {
+            return true;
+        }
+        if (this->hasDeadline && std::chrono::steady_clock::now() >= this->deadline) {
+            this->cancel();
+            return true;
         }
+        return false;
     }
 };
 
-// thread safe map
-struct MapSafe {
+// client of a GNU make jobserver, named in MAKEFLAGS by
+// --jobserver-auth=R,W (an inherited pipe), --jobserver-auth=fifo:PATH or the
+// older --jobserver-fds=R,W; every crawler thread but the first holds one of
+// its tokens while working, the first using the token make already holds
+// for this process
+struct JobServer {
    private:
-    std::unordered_map<std::string, std::list<std::string>> map;
-    std::mutex mutex;
+    int readFd = -1;
+    int writeFd = -1;
+    bool ownsReadFd = false;
+    bool ownsWriteFd = false;
 
    public:
-    std::unordered_map<std::string, std::list<std::string>>::iterator find(std::string string) {
-        //std::unique_lock<std::mutex> lock(mutex);
-        return this->map.find(string);
-    }
-
-    std::unordered_map<std::string, std::list<std::string>>::iterator end() {
-        //std::unique_lock<std::mutex> lock(mutex);
-        return this->map.end();
+    ~JobServer() {
+        if (this->ownsReadFd) {
+            close(this->readFd);
+        }
+        if (this->ownsWriteFd) {
+            close(this->writeFd);
+        }
     }
 
-    bool inMap(std::string s) {
-        std::unique_lock<std::mutex> lock(mutex);
-        if (this->map.find(s) == this->map.end()) {
-            return true;
-        } else {
+    // returns false if makeflags names no usable jobserver
+    bool connect(const char* makeflags) {
+        if (makeflags == NULL) {
+            return false;
+        }
+        // the last occurrence wins
+        std::string flags(makeflags), auth;
+        for (const char* option : {"--jobserver-auth=", "--jobserver-fds="}) {
+            std::string::size_type pos = flags.rfind(option);
+            if (pos != std::string::npos) {
+                pos += strlen(option);
+                auth = flags.substr(pos, flags.find(' ', pos) - pos);
+                break;
+            }
+        }
+        if (auth.compare(0, 5, "fifo:") == 0) {
+            this->readFd = open(auth.c_str() + 5, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+            this->writeFd = this->readFd;
+            this->ownsReadFd = this->readFd >= 0;
+            return this->readFd >= 0;
+        }
+        int r, w;
+        if (sscanf(auth.c_str(), "%d,%d", &r, &w) != 2 || r < 0 || w < 0 ||
+            fcntl(r, F_GETFD) == -1 || fcntl(w, F_GETFD) == -1) {
+            // make only passes the pipe to recipes marked with '+'
+            return false;
+        }
+        // reopen the pipe so that non-blocking reads don't change the file
+        // description shared with make and the other jobs; without that,
+        // another job could take the token between poll() and a blocking
+        // read(), so the jobserver goes unused
+        std::string path = "/proc/self/fd/" + std::to_string(r);
+        this->readFd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (this->readFd < 0) {
             return false;
         }
+        this->ownsReadFd = true;
+        this->writeFd = w;
+        return true;
     }
 
-    void insert(std::pair<std::string, std::list<std::string>> pair) {
-        std::unique_lock<std::mutex> lock(mutex);
-        this->map.insert(pair);
+    bool isActive() {
+        return this->readFd >= 0;
     }
 
-    std::list<std::string>* getValue(std::string string) {
-        std::unique_lock<std::mutex> lock(mutex);
-        return &this->map[string];
+    // wait up to timeoutMs for a token, returning false if none arrived
+    bool acquire(char* token, int timeoutMs) {
+        struct pollfd pfd = {this->readFd, POLLIN, 0};
+        if (poll(&pfd, 1, timeoutMs) <= 0) {
+            return false;
+        }
+        return read(this->readFd, token, 1) == 1;
+    }
+
+    void release(char token) {
+        while (write(this->writeFd, &token, 1) < 0 && errno == EINTR) {
+        }
     }
 };
 
-std::vector<std::string> dirs;
-MapSafe theTable;
-QueueSafe workQ;
+// background mode (--background): lowers the process's CPU and I/O
+// priority, bounds the number of files being read at once, and backs
+// crawler threads off while /proc/pressure reports the machine as loaded
+struct Background {
+   private:
+    static constexpr int PRESSURE_CHECK_MS = 100;
+    static constexpr double PRESSURE_LIMIT = 10.0;  // % of time stalled, over 10s
 
-std::string dirName(const char* c_str) {
-    std::string s = c_str;  // s takes ownership of the string content by allocating memory for it
-    if (s.back() != '/') {
-        s += '/';
-    }
-    return s;
-}
+    bool enabled = false;
+    sem_t reads;
+    std::mutex mutex;
+    std::chrono::steady_clock::time_point checked;
+    bool loaded = false;
+    std::atomic<long> yieldedMs{0};  // wall time, in PRESSURE_CHECK_MS steps
 
-std::pair<std::string, std::string> parseFile(const char* c_file) {
-    std::string file = c_file;
-    std::string::size_type pos = file.rfind('.');
-    if (pos == std::string::npos) {
-        return {file, ""};
-    } else {
-        return {file.substr(0, pos), file.substr(pos + 1)};
+    // the "some avg10" figure of /proc/pressure/resource, or 0 if it can't
+    // be read (kernels without PSI)
+    static double pressure(const char* resource) {
+        std::string path = std::string("/proc/pressure/") + resource;
+        FILE* fd = fopen(path.c_str(), "r");
+        if (fd == NULL) {
+            return 0;
+        }
+        double avg10 = 0;
+        if (fscanf(fd, "some avg10=%lf", &avg10) != 1) {
+            avg10 = 0;
+        }
+        fclose(fd);
+        return avg10;
     }
-}
 
-// open file using the directory search path constructed in main()
-static FILE* openFile(const char* file) {
-    FILE* fd;
-    for (unsigned int i = 0; i < dirs.size(); i++) {
-        std::string path = dirs[i] + file;
-        fd = fopen(path.c_str(), "r");
-        if (fd != NULL)
-            return fd;  // return the first file that successfully opens
+   public:
+    // drop to the lowest CPU and I/O priority (threads started afterwards
+    // inherit it; each step is best effort) and allow maxReads files to be
+    // read at once
+    void enable(int maxReads) {
+        this->enabled = true;
+        sem_init(&this->reads, 0, maxReads);
+        setpriority(PRIO_PROCESS, 0, 19);
+        struct sched_param param = {0};
+        sched_setscheduler(0, SCHED_IDLE, &param);
+        // IOPRIO_WHO_PROCESS, IOPRIO_CLASS_IDLE
+        syscall(SYS_ioprio_set, 1, 0, 3 << 13);
     }
-    return NULL;
-}
 
-// process file, looking for #include "foo.h" lines
-static void process(const char* file, std::list<std::string>* ll) {
-    char buf[4096], name[4096];
-    // 1. open the file
-    FILE* fd = openFile(file);
-    if (fd == NULL) {
-        fprintf(stderr, "Error opening %s\n", file);
-        exit(-1);
+    bool isEnabled() {
+        return this->enabled;
     }
-    while (fgets(buf, sizeof(buf), fd) != NULL) {
-        char* p = buf;
-        // 2a. skip leading whitespace
-        while (isspace((int)*p)) {
-            p++;
-        }
-        // 2b. if match #include
-        if (strncmp(p, "#include", 8) != 0) {
-            continue;
-        }
-        p += 8;  // point to first character past #include
-        // 2bi. skip leading whitespace
-        while (isspace((int)*p)) {
-            p++;
+
+    void beginRead() {
+        if (this->enabled) {
+            while (sem_wait(&this->reads) != 0 && errno == EINTR) {
+            }
         }
-        if (*p != '"') {
-            continue;
+    }
+
+    void endRead() {
+        if (this->enabled) {
+            sem_post(&this->reads);
         }
-        // 2bii. next character is a "
-        p++;  // skip "
-        // 2bii. collect remaining characters of file name
-        char* q = name;
-        while (*p != '\0') {
-            if (*p == '"') {
-                break;
+    }
+
+    // called before each file is crawled: while CPU or I/O pressure is over
+    // the limit, sleep (rechecking every PRESSURE_CHECK_MS) unless cancel
+    // is called for.  a check finding the machine loaded holds every thread
+    // back until the next, so each counts PRESSURE_CHECK_MS once, however
+    // many threads sleep through it
+    void pace(CancelToken* cancel) {
+        while (this->enabled && !cancel->isCancelled()) {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            auto now = std::chrono::steady_clock::now();
+            if (now - this->checked >= std::chrono::milliseconds(PRESSURE_CHECK_MS)) {
+                this->checked = now;
+                this->loaded = pressure("cpu") > PRESSURE_LIMIT || pressure("io") > PRESSURE_LIMIT;
+                if (this->loaded) {
+                    this->yieldedMs += PRESSURE_CHECK_MS;
+                }
             }
-            *q++ = *p++;
-        }
-        *q = '\0';
-        // 2bii. append file name to dependency list
-        ll->push_back({name});
-        // 2bii. if file name not already in table ...
-        if (!theTable.inMap(name)) {
-            continue;
+            bool loaded = this->loaded;
+            lock.unlock();
+            if (!loaded) {
+                return;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(PRESSURE_CHECK_MS));
         }
-        // ... insert mapping from file name to empty list in table ...
-        theTable.insert({name, {}});
-        // ... append file name to workQ
-        workQ.push_back(name);
     }
-    // 3. close file
-    fclose(fd);
-}
 
-// iteratively print dependencies
-static void printDependencies(std::unordered_set<std::string>* printed,
-                              std::list<std::string>* toProcess,
-                              FILE* fd) {
-    if (!printed || !toProcess || !fd)
-        return;
+    // wall time the crawl spent backed off
+    long yielded() {
+        return this->yieldedMs.load();
+    }
+};
 
-    // 1. while there is still a file in the toProcess list
-    while (toProcess->size() > 0) {
-        // 2. fetch next file to process
-        std::string name = toProcess->front();
-        toProcess->pop_front();
-        // 3. lookup file in the table, yielding list of dependencies
-        std::list<std::string>* ll = theTable.getValue(name);
-        // 4. iterate over dependencies
-        for (auto iter = ll->begin(); iter != ll->end(); iter++) {
-            // 4a. if filename is already in the printed table, continue
-            if (printed->find(*iter) != printed->end()) {
-                continue;
-            }
-            // 4b. print filename
-            fprintf(fd, " %s", iter->c_str());
-            // 4c. insert into printed
-            printed->insert(*iter);
-            // 4d. append to toProcess
-            toProcess->push_back(*iter);
+// crawl counters for --stats
+struct CrawlStats {
+    std::atomic<long> files{0};   // files crawled
+    std::atomic<long> cached{0};  // of which found in a scan cache
+    std::atomic<long> bytes{0};   // bytes read from the rest
+    std::atomic<long> imported{0};  // targets taken from .d files unscanned
+    std::atomic<long> precise{0};   // files rescanned by the precise lexer
+    std::atomic<long> deduped{0};   // files whose contents were scanned before
+    std::atomic<long> dedupBytes{0};  // bytes of them, not scanned again
+
+    // write the counters, and the throughput over seconds of crawling
+    void report(double seconds, long yieldedMs, FILE* fd) {
+        fprintf(fd, "stats: files=%ld cached=%ld imported=%ld precise=%ld deduped=%ld saved=%ld bytes=%ld crawl=%.3fs files/s=%.0f MB/s=%.2f yielded=%ldms\n",
+                this->files.load(), this->cached.load(), this->imported.load(), this->precise.load(),
+                this->deduped.load(), this->dedupBytes.load(), this->bytes.load(), seconds,
+                seconds > 0 ? this->files.load() / seconds : 0,
+                seconds > 0 ? this->bytes.load() / seconds / 1e6 : 0, yieldedMs);
+    }
+};
+
+// categories of data structure tracked by --memory-report
+enum MemCategory {
+    MEM_STRINGS,  // out-of-line bytes of file name strings
+    MEM_TABLE,    // dependency table nodes and buckets
+    MEM_EDGES,    // dependency list nodes
+    MEM_WORKQ,    // work queue nodes and their names
+    MEM_CLOSURE,  // per-target printed set and toProcess list
+    MEM_OUTPUT,   // output buffer
+    MEM_SNAPSHOT, // snapshots built, loaded or compared
+    MEM_CATEGORIES
+};
+
+static const char* memCategoryNames[MEM_CATEGORIES] = {
+    "strings", "table", "edges", "workq", "closure", "output", "snapshot"};
+
+// thread safe memory tracker
+struct MemoryTracker {
+   private:
+    bool enabled = false;
+    std::atomic<long> current[MEM_CATEGORIES] = {};
+    std::atomic<long> peak[MEM_CATEGORIES] = {};
+    std::atomic<long> totalCurrent{0};
+    std::atomic<long> totalPeak{0};
+
+    static void raise(std::atomic<long>& max, long value) {
+        long seen = max.load(std::memory_order_relaxed);
+        while (value > seen && !max.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {
         }
     }
-}
 
-int main(int argc, char* argv[]) {
-    // 1. look up CPATH in environment
-    char* cpath = getenv("CPATH");
-    char* crawlerthreads = getenv("CRAWLER_THREADS");
-    int number_of_threads;
-    if (crawlerthreads == NULL) {
-        number_of_threads = 2;
-    } else {
-        number_of_threads = std::stoi(crawlerthreads);
+   public:
+    void enable() {
+        this->enabled = true;
     }
 
-    // init. setup threads, locks and condition variables
-    std::vector<std::thread> threads;
-    ThreadTracker tracker(number_of_threads);
+    bool isEnabled() {
+        return this->enabled;
+    }
 
-    // determine the number of -Idir arguments
-    int i;
-    for (i = 1; i < argc; i++) {
-        if (strncmp(argv[i], "-I", 2) != 0)
-            break;
+    long bytes(MemCategory category) {
+        return this->current[category].load(std::memory_order_relaxed);
     }
-    int start = i;
 
-    // 2. start assembling dirs vector
-    dirs.push_back(dirName("./"));  // always search current directory first
-    for (i = 1; i < start; i++) {
-        dirs.push_back(dirName(argv[i] + 2 /* skip -I */));
+    long total() {
+        return this->totalCurrent.load(std::memory_order_relaxed);
     }
-    if (cpath != NULL) {
-        std::string str(cpath);
-        std::string::size_type last = 0;
-        std::string::size_type next = 0;
-        while ((next = str.find(":", last)) != std::string::npos) {
-            dirs.push_back(str.substr(last, next - last));
-            last = next + 1;
+
+    void add(MemCategory category, long bytes) {
+        if (!this->enabled || bytes == 0) {
+            return;
         }
-        dirs.push_back(str.substr(last));
+        raise(this->peak[category], this->current[category].fetch_add(bytes) + bytes);
+        raise(this->totalPeak, this->totalCurrent.fetch_add(bytes) + bytes);
     }
-    // 2. finished assembling dirs vector
 
-    // 3. for each file argument ...
-    for (i = start; i < argc; i++) {
-        std::pair<std::string, std::string> pair = parseFile(argv[i]);
-        if (pair.second != "c" && pair.second != "y" && pair.second != "l") {
-            fprintf(stderr, "Illegal extension: %s - must be .c, .y or .l\n",
-                    pair.second.c_str());
-            return -1;
+    void sub(MemCategory category, long bytes) {
+        this->add(category, -bytes);
+    }
+
+    void report(FILE* fd) {
+        for (int c = 0; c < MEM_CATEGORIES; c++) {
+            fprintf(fd, "memory: %s final=%ld peak=%ld\n", memCategoryNames[c],
+                    this->current[c].load(), this->peak[c].load());
         }
+        fprintf(fd, "memory: total final=%ld peak=%ld\n", this->totalCurrent.load(),
+                this->totalPeak.load());
+    }
+};
+
+MemoryTracker memTracker;
 
-        std::string obj = pair.first + ".o";
+// how large arrays are backed (--huge-pages)
+enum HugePageMode { HUGE_PAGES_OFF, HUGE_PAGES_THP, HUGE_PAGES_HUGETLB };
 
-        // 3a. insert mapping from file.o to file.ext
-        theTable.insert({obj, {argv[i]}});
+static HugePageMode hugePageMode = HUGE_PAGES_OFF;
+static const std::size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
 
-        // 3b. insert mapping from file.ext to empty list
-        theTable.insert({argv[i], {}});
+// allocator placing allocations of a huge page or more in their own
+// mappings, backed by explicit huge pages (falling back to transparent huge
+// pages if none are reserved) or by transparent huge pages; smaller
+// allocations, and all of them when hugePageMode is off, use operator new.
+// hugePageMode must only be set before the first allocation
+template <typename T>
+struct HugePageAllocator {
+    typedef T value_type;
 
-        // 3c. append file.ext on workQ
-        workQ.push_back(argv[i]);
+    HugePageAllocator() = default;
+
+    template <typename U>
+    HugePageAllocator(const HugePageAllocator<U>&) {
     }
 
-    // 4. for each file on the workQ
-    for (int i = 0; i < number_of_threads; i++) {
-        threads.push_back(std::thread([tracker = &tracker]() {
-            while (true) {
-                auto filename = workQ.pop_front();
-                if (!filename.empty()) {
-                    // 4a&b. lookup dependencies and invoke 'process'
-                    process(filename.c_str(), theTable.getValue(filename));
-                } else {
-                    break;
-                }
+    static bool isHuge(std::size_t n) {
+        return hugePageMode != HUGE_PAGES_OFF && n * sizeof(T) >= HUGE_PAGE_SIZE;
+    }
+
+    static std::size_t mappedBytes(std::size_t n) {
+        return (n * sizeof(T) + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    }
+
+    T* allocate(std::size_t n) {
+        if (!isHuge(n)) {
+            return std::allocator<T>().allocate(n);
+        }
+        void* p = MAP_FAILED;
+        if (hugePageMode == HUGE_PAGES_HUGETLB) {
+            p = mmap(NULL, mappedBytes(n), PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        }
+        if (p == MAP_FAILED) {
+            p = mmap(NULL, mappedBytes(n), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED) {
+                throw std::bad_alloc();
             }
-            tracker->signal_done();
-        }));
+            madvise(p, mappedBytes(n), MADV_HUGEPAGE);
+        }
+        return (T*)p;
     }
 
-    tracker.wait_done();
-    for (auto& thread : threads) {
-        if (thread.joinable()) {
-            thread.join();
+    void deallocate(T* p, std::size_t n) {
+        if (!isHuge(n)) {
+            std::allocator<T>().deallocate(p, n);
+        } else {
+            munmap(p, mappedBytes(n));
         }
     }
 
-    // 5. for each file argument
-    for (i = start; i < argc; i++) {
-        // 5a. create hash table in which to track file names already printed
-        std::unordered_set<std::string> printed;
-        // 5b. create list to track dependencies yet to print
-        std::list<std::string> toProcess;
+    template <typename U>
+    bool operator==(const HugePageAllocator<U>&) const {
+        return true;
+    }
+
+    template <typename U>
+    bool operator!=(const HugePageAllocator<U>&) const {
+        return false;
+    }
+};
 
-        std::pair<std::string, std::string> pair = parseFile(argv[i]);
+template <typename T>
+using HugeVector = std::vector<T, HugePageAllocator<T>>;
 
-        std::string obj = pair.first + ".o";
-        // 5c. print "foo.o:" ...
-        printf("%s:", obj.c_str());
-        // 5c. ... insert "foo.o" into hash table and append to list
-        printed.insert(obj);
-        toProcess.push_back(obj);
-        // 5d. invoke
-        printDependencies(&printed, &toProcess, stdout);
+// bytes a string holds outside of its own object (0 when the small string
+// optimisation keeps the characters inline)
+static long stringHeapBytes(const std::string& s) {
+    const char* data = s.data();
+    const char* self = reinterpret_cast<const char*>(&s);
+    if (data >= self && data < self + sizeof(std::string)) {
+        return 0;
+    }
+    return s.capacity() + 1;
+}
+
+// 64 bit hash of the len bytes at p, in the style of wyhash: 16 bytes at a
+// time are folded in with 64x64->128 bit multiplies
+static inline uint64_t hashMix(uint64_t a, uint64_t b) {
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static inline uint64_t hashRead(const char* p, std::size_t len) {
+    uint64_t v = 0;
+    memcpy(&v, p, len);
+    return v;
+}
 
-        printf("\n");
+static uint64_t pathHash(const char* p, std::size_t len, uint64_t s0 = 0xa0761d6478bd642full) {
+    static const uint64_t s1 = 0xe7037ed1a0b428dbull;
+    uint64_t seed = s0 ^ hashMix(len ^ s0, s1);
+    std::size_t left = len;
+    for (; left > 16; left -= 16, p += 16) {
+        seed = hashMix(hashRead(p, 8) ^ s1, hashRead(p + 8, 8) ^ seed);
+    }
+    uint64_t a, b;
+    if (left > 8) {
+        a = hashRead(p, 8);
+        b = hashRead(p + left - 8, 8);
+    } else {
+        a = hashRead(p, left);
+        b = 0;
     }
+    return hashMix(s1 ^ len, hashMix(a ^ s1, b ^ seed));
+}
+
+// names found in each distinct file content scanned (--dedup), so that
+// identical copies of a file in different directories are scanned once;
+// contents are identified by their size and a 128 bit digest of two
+// differently seeded pathHash()es, so that a collision between distinct
+// contents is as unlikely as one of a 128 bit hash (the contents
+// themselves aren't kept to compare)
+struct ContentCache {
+   public:
+    struct Digest {
+        uint64_t lo, hi;
+        std::size_t size;
+    };
 
-    return 0;
+   private:
+    struct Entry {
+        uint64_t hi;
+        std::size_t size;
+        std::string names;
+    };
+
+    bool enabled = false;
+    std::unordered_map<uint64_t, Entry> names;  // keyed by Digest::lo
+    std::mutex mutex;
+
+   public:
+    void enable() {
+        this->enabled = true;
+    }
+
+    bool isEnabled() {
+        return this->enabled;
+    }
+
+    // the digest of contents as scanned by the scanner with id (the same
+    // bytes scanned as another language may name other files)
+    static Digest digest(const std::string& contents, uint64_t id) {
+        uint64_t salt = hashMix(id, 0x9e3779b97f4a7c15ull);
+        return {pathHash(contents.data(), contents.size()) ^ salt,
+                pathHash(contents.data(), contents.size(), 0x8ebc6af09c88c6e3ull) ^ salt, contents.size()};
+    }
+
+    bool find(const Digest& d, std::string* found) {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        auto it = this->names.find(d.lo);
+        if (it == this->names.end() || it->second.hi != d.hi || it->second.size != d.size) {
+            return false;
+        }
+        *found = it->second.names;
+        return true;
+    }
+
+    // (a digest whose low half is taken by other contents isn't kept)
+    void insert(const Digest& d, const std::string& found) {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        if (this->names.insert({d.lo, {d.hi, d.size, found}}).second) {
+            memTracker.add(MEM_TABLE, 2 * sizeof(void*) + sizeof(std::pair<uint64_t, Entry>));
+            memTracker.add(MEM_STRINGS, stringHeapBytes(found));
+        }
+    }
+};
+
+// a file name together with its hash, computed once when the name is
+// scanned and then used by every hash table the name is put in
+struct PathKey {
+    std::string name;
+    uint64_t hash = 0;
+
+    PathKey() = default;
+
+    PathKey(std::string name) : name(std::move(name)) {
+        this->hash = pathHash(this->name.data(), this->name.size());
+    }
+
+    PathKey(const char* name) : PathKey(std::string(name)) {
+    }
+
+    PathKey(const char* name, uint64_t hash) : name(name), hash(hash) {
+    }
+
+    bool operator==(const PathKey& other) const {
+        return this->hash == other.hash && this->name == other.name;
+    }
+};
+
+struct PathKeyHash {
+    std::size_t operator()(const PathKey& key) const {
+        return key.hash;
+    }
+};
+
+// bytes of a std::list node holding a PathKey (two links plus the value)
+static long listNodeBytes() {
+    return 2 * sizeof(void*) + sizeof(PathKey);
+}
+
+// bytes of a std::list node holding a file ID (two links plus the ID,
+// padded to pointer alignment)
+static long idNodeBytes() {
+    return 3 * sizeof(void*);
+}
+
+// (defined with the globals it cancels)
+static void crawlError(const std::string& message);
+
+// interner giving every file name a stable 32 bit ID, in the order names
+// are first seen
+//
+// lookups are lock free: the open addressing table (linear probing, at most
+// half full) is read through an atomic pointer, and a slot publishes its ID
+// before its hash, so a reader that sees the hash also sees the ID and the
+// name behind it.  inserts, which happen once per distinct name, take a
+// mutex, under which the table is doubled when needed; replaced tables are
+// kept until the interner is destroyed, as readers may still be probing
+// them
+//
+// names are stored prefix compressed, as a (directory, basename) pair: the
+// directories form a trie with a node per distinct path component, so the
+// bytes kept are proportional to the distinct components, not to the total
+// length of the names.  full names are only put back together when written
+// out.  the bytes of components and basenames live in an arena of 64KB
+// blocks, and the ID -> name and node -> component directories in segments
+// of 4096 entries, so none of them ever move
+struct Interner {
+   public:
+    static const uint32_t NONE = UINT32_MAX;
+
+   private:
+    static const int SEGMENT_BITS = 12;
+    static const uint32_t SEGMENT_SIZE = 1u << SEGMENT_BITS;
+    static const uint32_t MAX_SEGMENTS = 1u << 16;
+    static constexpr std::size_t ARENA_BLOCK = 64 * 1024;
+
+    struct Slot {
+        std::atomic<uint64_t> hash;  // 0 while the slot is free
+        std::atomic<uint32_t> id;
+    };
+
+    struct Table {
+        std::size_t mask;
+        Slot* slots;
+    };
+
+    struct Name {
+        uint64_t hash;
+        const char* base;
+        uint32_t baseLength;
+        uint32_t length;  // of the full name
+        uint32_t dir;     // trie node of everything up to the last '/'
+    };
+
+    // a component of a directory, without its '/'; node 0 is the root
+    struct Dir {
+        const char* chars;
+        uint32_t length;
+        uint32_t parent;
+    };
+
+    // array that grows a segment at a time; set() only under the mutex
+    template <typename T>
+    struct Segments {
+        std::atomic<T*>* segments = new std::atomic<T*>[MAX_SEGMENTS]();
+
+        ~Segments() {
+            for (uint32_t s = 0; s < MAX_SEGMENTS && this->segments[s].load() != NULL; s++) {
+                delete[] this->segments[s].load();
+            }
+            delete[] this->segments;
+        }
+
+        const T& get(uint32_t i) const {
+            return this->segments[i >> SEGMENT_BITS].load(std::memory_order_acquire)[i & (SEGMENT_SIZE - 1)];
+        }
+
+        // returns the bytes allocated
+        long set(uint32_t i, const T& value) {
+            long bytes = 0;
+            if ((i & (SEGMENT_SIZE - 1)) == 0) {
+                this->segments[i >> SEGMENT_BITS].store(new T[SEGMENT_SIZE], std::memory_order_release);
+                bytes = SEGMENT_SIZE * sizeof(T);
+            }
+            this->segments[i >> SEGMENT_BITS].load(std::memory_order_relaxed)[i & (SEGMENT_SIZE - 1)] = value;
+            return bytes;
+        }
+    };
+
+    std::atomic<Table*> table;
+    std::vector<Table*> tables;  // every table allocated, the current last
+    Segments<Name> names;
+    Segments<Dir> trie;
+    std::unordered_map<std::string, uint32_t> children;  // parent node + component -> node
+    std::atomic<uint32_t> count{0};
+    uint32_t dirCount = 0;
+    std::mutex mutex;
+    std::vector<char*> blocks;
+    char* arenaNext = NULL;
+    std::size_t arenaLeft = 0;
+    long bytes[MEM_CATEGORIES] = {};  // accounted to the memory tracker
+
+    static uint64_t tag(uint64_t hash) {
+        return hash == 0 ? 1 : hash;
+    }
+
+    void account(MemCategory category, long size) {
+        memTracker.add(category, size);
+        this->bytes[category] += size;
+    }
+
+    // whether n is the len bytes at name: the basename, then each directory
+    // component from the last back to the first
+    bool equals(const Name& n, const char* name, std::size_t len) const {
+        if (n.length != len) {
+            return false;
+        }
+        std::size_t pos = len - n.baseLength;
+        if (memcmp(name + pos, n.base, n.baseLength) != 0) {
+            return false;
+        }
+        for (uint32_t node = n.dir; node != 0;) {
+            const Dir& d = this->trie.get(node);
+            pos -= d.length + 1;
+            if (name[pos + d.length] != '/' || memcmp(name + pos, d.chars, d.length) != 0) {
+                return false;
+            }
+            node = d.parent;
+        }
+        return true;
+    }
+
+    uint32_t lookup(const Table* t, const char* name, std::size_t len, uint64_t hash) const {
+        for (std::size_t i = hash & t->mask;; i = (i + 1) & t->mask) {
+            uint64_t h = t->slots[i].hash.load(std::memory_order_acquire);
+            if (h == 0) {
+                return NONE;
+            }
+            if (h == hash) {
+                uint32_t id = t->slots[i].id.load(std::memory_order_relaxed);
+                if (this->equals(this->names.get(id), name, len)) {
+                    return id;
+                }
+            }
+        }
+    }
+
+    Table* newTable(std::size_t capacity) {
+        Table* t = new Table{capacity - 1, new Slot[capacity]()};
+        this->tables.push_back(t);
+        this->account(MEM_TABLE, capacity * sizeof(Slot));
+        return t;
+    }
+
+    static void place(Table* t, uint32_t id, uint64_t hash) {
+        std::size_t i = hash & t->mask;
+        while (t->slots[i].hash.load(std::memory_order_relaxed) != 0) {
+            i = (i + 1) & t->mask;
+        }
+        t->slots[i].id.store(id, std::memory_order_relaxed);
+        t->slots[i].hash.store(hash, std::memory_order_release);
+    }
+
+    // copy len bytes at p into the arena
+    const char* copy(const char* p, std::size_t len) {
+        if (this->arenaLeft < len) {
+            std::size_t size = std::max(ARENA_BLOCK, len);
+            this->arenaNext = (char*)malloc(size);
+            this->arenaLeft = size;
+            this->blocks.push_back(this->arenaNext);
+            this->account(MEM_STRINGS, size);
+        }
+        char* chars = this->arenaNext;
+        memcpy(chars, p, len);
+        this->arenaNext += len;
+        this->arenaLeft -= len;
+        return chars;
+    }
+
+    // trie node of the directories in the len bytes at name (which end with
+    // a '/' unless empty), adding nodes as needed
+    uint32_t dirNode(const char* name, std::size_t len) {
+        uint32_t node = 0;
+        std::size_t start = 0;
+        for (std::size_t i = 0; i < len; i++) {
+            if (name[i] != '/') {
+                continue;
+            }
+            std::string key((const char*)&node, sizeof(node));
+            key.append(name + start, i - start);
+            auto it = this->children.find(key);
+            if (it != this->children.end()) {
+                node = it->second;
+            } else {
+                uint32_t child = this->dirCount++;
+                this->account(MEM_TABLE,
+                              this->trie.set(child, {this->copy(name + start, i - start),
+                                                     (uint32_t)(i - start), node}));
+                std::size_t buckets = this->children.bucket_count();
+                this->children.emplace(key, child);
+                this->account(MEM_TABLE, 2 * sizeof(void*) + sizeof(std::pair<std::string, uint32_t>) +
+                                             (this->children.bucket_count() - buckets) * sizeof(void*));
+                this->account(MEM_STRINGS, stringHeapBytes(key));
+                node = child;
+            }
+            start = i + 1;
+        }
+        return node;
+    }
+
+    void appendDir(uint32_t node, std::string* s) const {
+        if (node != 0) {
+            const Dir& d = this->trie.get(node);
+            this->appendDir(d.parent, s);
+            s->append(d.chars, d.length);
+            s->push_back('/');
+        }
+    }
+
+    void writeDir(uint32_t node, FILE* fd) const {
+        if (node != 0) {
+            const Dir& d = this->trie.get(node);
+            this->writeDir(d.parent, fd);
+            fwrite(d.chars, 1, d.length, fd);
+            putc('/', fd);
+        }
+    }
+
+   public:
+    Interner() {
+        this->table.store(this->newTable(1024));
+        this->account(MEM_TABLE, this->trie.set(this->dirCount++, {"", 0, 0}));
+    }
+
+    ~Interner() {
+        for (Table* t : this->tables) {
+            delete[] t->slots;
+            delete t;
+        }
+        for (char* block : this->blocks) {
+            free(block);
+        }
+        for (int c = 0; c < MEM_CATEGORIES; c++) {
+            memTracker.sub((MemCategory)c, this->bytes[c]);
+        }
+    }
+
+    // ID of name, or NONE if it hasn't been interned
+    uint32_t find(const char* name, std::size_t len, uint64_t hash) const {
+        return this->lookup(this->table.load(std::memory_order_acquire), name, len, tag(hash));
+    }
+
+    // ID of name, interning it if needed; sets added to whether this call
+    // interned it, which happens for exactly one caller per name
+    uint32_t intern(const char* name, std::size_t len, uint64_t hash, bool* added) {
+        hash = tag(hash);
+        *added = false;
+        uint32_t id = this->lookup(this->table.load(std::memory_order_acquire), name, len, hash);
+        if (id != NONE) {
+            return id;
+        }
+        std::unique_lock<std::mutex> lock(this->mutex);
+        Table* t = this->table.load(std::memory_order_relaxed);
+        id = this->lookup(t, name, len, hash);
+        if (id != NONE) {
+            return id;
+        }
+        id = this->count.load(std::memory_order_relaxed);
+        if (id == MAX_SEGMENTS * SEGMENT_SIZE - 1 || this->dirCount + len >= MAX_SEGMENTS * SEGMENT_SIZE) {
+            // (the crawl is cancelled; the last name stands in for this
+            // one until it unwinds)
+            crawlError("Error: too many file names");
+            return id - 1;
+        }
+        // split the name after its last '/', and add it to the directory,
+        // then publish it in the table
+        const char* slash = (const char*)memrchr(name, '/', len);
+        std::size_t dirLength = slash == NULL ? 0 : slash - name + 1;
+        Name n = {hash, this->copy(name + dirLength, len - dirLength), (uint32_t)(len - dirLength),
+                  (uint32_t)len, this->dirNode(name, dirLength)};
+        this->account(MEM_TABLE, this->names.set(id, n));
+        this->count.store(id + 1, std::memory_order_release);
+        if (2 * (std::size_t)(id + 1) > t->mask + 1) {
+            t = this->newTable(2 * (t->mask + 1));
+            for (uint32_t old = 0; old < id; old++) {
+                place(t, old, this->names.get(old).hash);
+            }
+            place(t, id, hash);
+            this->table.store(t, std::memory_order_release);
+        } else {
+            place(t, id, hash);
+        }
+        *added = true;
+        return id;
+    }
+
+    // the interned name with ID id
+    std::string name(uint32_t id) const {
+        const Name& n = this->names.get(id);
+        std::string s;
+        s.reserve(n.length);
+        this->appendDir(n.dir, &s);
+        s.append(n.base, n.baseLength);
+        return s;
+    }
+
+    // write the interned name with ID id to fd
+    void write(uint32_t id, FILE* fd) const {
+        const Name& n = this->names.get(id);
+        this->writeDir(n.dir, fd);
+        fwrite(n.base, 1, n.baseLength, fd);
+    }
+
+    uint32_t size() const {
+        return this->count.load(std::memory_order_acquire);
+    }
+};
+
+// thread safe queue
+struct QueueSafe {
+   private:
+    std::list<PathKey> q;
+    bool open = false;
+    int busy = 0;  // names handed out by pop_front_wait() and not yet done()
+    std::mutex mutex;
+    std::condition_variable cv;
+
+   public:
+    void push_back(PathKey key) {
+        std::unique_lock<std::mutex> lock(mutex);
+        this->q.push_back(key);
+        memTracker.add(MEM_WORKQ, listNodeBytes() + stringHeapBytes(this->q.back().name));
+        lock.unlock();
+        this->cv.notify_one();
+    }
+
+    PathKey pop_front() {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (this->q.empty() == true) {
+            return PathKey();
+        } else {
+            PathKey key = this->q.front();
+            memTracker.sub(MEM_WORKQ, listNodeBytes() + stringHeapBytes(this->q.front().name));
+            this->q.pop_front();
+            return key;
+        }
+    }
+
+    // like pop_front(), but while the queue may still be refilled (it is
+    // open, or a name handed out is still being processed) waits up to
+    // timeoutMs for a name to be pushed; the caller calls done() once it
+    // has processed a name returned
+    PathKey pop_front_wait(int timeoutMs) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (this->q.empty() && (this->open || this->busy > 0)) {
+            this->cv.wait_for(lock, std::chrono::milliseconds(timeoutMs));
+        }
+        if (this->q.empty()) {
+            return PathKey();
+        }
+        PathKey key = this->q.front();
+        memTracker.sub(MEM_WORKQ, listNodeBytes() + stringHeapBytes(this->q.front().name));
+        this->q.pop_front();
+        this->busy++;
+        return key;
+    }
+
+    void done() {
+        std::unique_lock<std::mutex> lock(mutex);
+        this->busy--;
+        bool drained = this->q.empty() && !this->open && this->busy == 0;
+        lock.unlock();
+        if (drained) {
+            this->cv.notify_all();
+        }
+    }
+
+    // whether the crawl is over: the queue is empty, closed, and no name
+    // being processed can add to it (an empty queue alone may only mean
+    // another thread is about to push what it finds)
+    bool isDrained() {
+        std::unique_lock<std::mutex> lock(mutex);
+        return this->q.empty() && !this->open && this->busy == 0;
+    }
+
+    std::size_t size() {
+        std::unique_lock<std::mutex> lock(mutex);
+        return this->q.size();
+    }
+
+    // an open queue may still receive names from outside the crawler
+    // threads (--files-from), so an empty one doesn't mean the crawl is over
+    void setOpen(bool open) {
+        std::unique_lock<std::mutex> lock(mutex);
+        this->open = open;
+        lock.unlock();
+        this->cv.notify_all();
+    }
+
+    bool isOpen() {
+        std::unique_lock<std::mutex> lock(mutex);
+        return this->open;
+    }
+
+    PathKey front() {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (this->q.empty() == true) {
+            return PathKey();
+        } else {
+            return this->q.front();
+        }
+    }
+};
+
+// thread safe spill file, holding dependency lists moved out of memory by
+// --memory-budget; the file is unlinked as soon as it is created, so it
+// disappears when the process exits
+struct SpillFile {
+   private:
+    int fd = -1;
+    long size = 0;
+    const char* mapped = NULL;
+    std::mutex mutex;
+
+   public:
+    ~SpillFile() {
+        if (this->mapped != NULL) {
+            munmap((void*)this->mapped, this->size);
+        }
+        if (this->fd >= 0) {
+            close(this->fd);
+        }
+    }
+
+    bool isOpen() {
+        return this->fd >= 0;
+    }
+
+    bool open() {
+        const char* tmpdir = getenv("TMPDIR");
+        std::string path = std::string(tmpdir != NULL ? tmpdir : "/tmp") + "/dependencyDiscoverer.XXXXXX";
+        this->fd = mkstemp(&path[0]);
+        if (this->fd < 0) {
+            return false;
+        }
+        unlink(path.c_str());
+        return true;
+    }
+
+    // append bytes, returning their offset in the file (-1 on failure)
+    long append(const std::string& bytes) {
+        std::unique_lock<std::mutex> lock(mutex);
+        long offset = this->size;
+        if (pwrite(this->fd, bytes.data(), bytes.size(), offset) != (ssize_t)bytes.size()) {
+            return -1;
+        }
+        this->size += bytes.size();
+        return offset;
+    }
+
+    // map the file for reading; must only be called once appending is done
+    const char* map() {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (this->mapped == NULL && this->size > 0) {
+            void* p = mmap(NULL, this->size, PROT_READ, MAP_SHARED, this->fd, 0);
+            if (p == MAP_FAILED) {
+                fprintf(stderr, "Error mapping spill file\n");
+                exit(-1);
+            }
+            this->mapped = (const char*)p;
+        }
+        return this->mapped;
+    }
+
+    // drop the mapped pages from memory; they are re-read on next access
+    void release() {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (this->mapped != NULL) {
+            madvise((void*)this->mapped, this->size, MADV_DONTNEED);
+        }
+    }
+};
+
+// stat signature of a file for the scan caches: device, inode, size and
+// modification and change times; a file is assumed unchanged while these are.
+// mode (the scanner, and whether --tiered rescans its files, see process())
+// is folded into the change time, so a cache never hands one kind of scan
+// the results of another; mode 0, the plain C scan, leaves it as it is
+static void statSignature(const struct stat& sb, uint64_t mode, uint64_t key[5]) {
+    key[0] = sb.st_dev;
+    key[1] = sb.st_ino;
+    key[2] = sb.st_size;
+    key[3] = sb.st_mtim.tv_sec * 1000000000ull + sb.st_mtim.tv_nsec;
+    key[4] = (sb.st_ctim.tv_sec * 1000000000ull + sb.st_ctim.tv_nsec) ^ (mode * 0x9e3779b97f4a7c15ull);
+}
+
+// scan cache shared through POSIX shared memory by every process on the
+// machine that names the same segment (--shm-cache); maps a file's stat
+// signature to the names it includes, so each file is scanned once
+// machine-wide while it is unchanged
+//
+// the segment is a header, a table of slots and an arena holding the names
+// ('\0' terminated).  it is lock free: a slot is claimed by a compare and
+// swap of its tag from 0, filled in, and published by a release store of
+// ready; readers only trust slots whose ready they load as 1.  entries are
+// never removed, a changed file simply gets a new slot; once the table or
+// arena is full, nothing more is cached
+struct ShmCache {
+   private:
+    static const uint64_t MAGIC = 0x444453484d433031ull;  // "DDSHMC01"
+    static const int MAX_PROBES = 64;
+
+    struct Slot {
+        std::atomic<uint64_t> tag;  // 0 if free, else hash of the key
+        std::atomic<uint32_t> ready;  // 1 once published, 2 if abandoned
+        uint32_t length;
+        uint64_t offset;
+        uint64_t key[5];  // st_dev, st_ino, st_size, st_mtim, st_ctim
+    };
+
+    struct Header {
+        std::atomic<uint64_t> magic;
+        uint64_t slots;
+        uint64_t arenaSize;
+        std::atomic<uint64_t> arenaUsed;
+    };
+
+    Header* header = NULL;
+    Slot* slots = NULL;
+    char* arena = NULL;
+    std::size_t size = 0;
+
+    static uint64_t keyHash(const uint64_t key[5]) {
+        uint64_t h = pathHash((const char*)key, 5 * sizeof(uint64_t));
+        return h == 0 ? 1 : h;
+    }
+
+   public:
+    ~ShmCache() {
+        if (this->header != NULL) {
+            munmap(this->header, this->size);
+        }
+    }
+
+    bool isOpen() {
+        return this->header != NULL;
+    }
+
+    // open the segment name, creating it with megabytes of space if it
+    // doesn't exist; returns false on failure
+    bool open(const char* name, long megabytes) {
+        this->size = megabytes * 1024 * 1024;
+        bool created = true;
+        int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0 && errno == EEXIST) {
+            created = false;
+            fd = shm_open(name, O_RDWR, 0600);
+        }
+        if (fd < 0) {
+            return false;
+        }
+        if (created && ftruncate(fd, this->size) != 0) {
+            close(fd);
+            shm_unlink(name);
+            return false;
+        }
+        // another process may still be sizing a segment it just created
+        struct stat sb;
+        for (int tries = 0; !created && fstat(fd, &sb) == 0 && sb.st_size == 0 && tries < 1000; tries++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        if (!created && (fstat(fd, &sb) != 0 || sb.st_size < (off_t)sizeof(Header))) {
+            close(fd);
+            return false;
+        }
+        if (!created) {
+            this->size = sb.st_size;
+        }
+        void* p = mmap(NULL, this->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) {
+            return false;
+        }
+        this->header = (Header*)p;
+        if (created) {
+            // a quarter of the segment for slots, the rest for names
+            this->header->slots = (this->size / 4) / sizeof(Slot);
+            this->header->arenaSize = this->size - sizeof(Header) - this->header->slots * sizeof(Slot);
+            this->header->magic.store(MAGIC, std::memory_order_release);
+        }
+        for (int tries = 0; this->header->magic.load(std::memory_order_acquire) != MAGIC; tries++) {
+            if (tries == 1000) {
+                munmap(this->header, this->size);
+                this->header = NULL;
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        if (sizeof(Header) + this->header->slots * sizeof(Slot) + this->header->arenaSize > this->size) {
+            munmap(this->header, this->size);
+            this->header = NULL;
+            return false;
+        }
+        this->slots = (Slot*)(this->header + 1);
+        this->arena = (char*)(this->slots + this->header->slots);
+        return true;
+    }
+
+    // look up the file with stat signature sb, as scanned in mode, setting
+    // names to the names it includes ('\0' terminated); returns false on a
+    // miss
+    bool find(const struct stat& sb, uint64_t mode, std::string* names) {
+        uint64_t key[5];
+        statSignature(sb, mode, key);
+        uint64_t hash = keyHash(key);
+        for (int i = 0; i < MAX_PROBES; i++) {
+            Slot* slot = &this->slots[(hash + i) % this->header->slots];
+            uint64_t tag = slot->tag.load(std::memory_order_acquire);
+            if (tag == 0) {
+                return false;
+            }
+            if (tag == hash && slot->ready.load(std::memory_order_acquire) == 1 &&
+                memcmp(slot->key, key, sizeof(key)) == 0) {
+                // the segment is shared, so check the slot stays in the arena
+                uint64_t offset = slot->offset, length = slot->length;
+                if (offset > this->header->arenaSize || length > this->header->arenaSize - offset) {
+                    return false;
+                }
+                names->assign(this->arena + offset, length);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // record names as the includes of the file with stat signature sb, as
+    // scanned in mode
+    void insert(const struct stat& sb, uint64_t mode, const std::string& names) {
+        uint64_t key[5];
+        statSignature(sb, mode, key);
+        uint64_t hash = keyHash(key);
+        for (int i = 0; i < MAX_PROBES; i++) {
+            Slot* slot = &this->slots[(hash + i) % this->header->slots];
+            uint64_t tag = 0;
+            if (!slot->tag.compare_exchange_strong(tag, hash, std::memory_order_acq_rel)) {
+                // the key is only complete once the slot is ready (or
+                // abandoned); one whose writer never gets there is passed
+                uint32_t ready = 0;
+                for (int spins = 0; tag == hash && spins < 1000; spins++) {
+                    if ((ready = slot->ready.load(std::memory_order_acquire)) != 0) {
+                        break;
+                    }
+                    sched_yield();
+                }
+                if (ready != 0 && memcmp(slot->key, key, sizeof(key)) == 0) {
+                    return;  // already cached, or given up on by someone else
+                }
+                continue;
+            }
+            memcpy(slot->key, key, sizeof(key));
+            uint64_t offset = this->header->arenaUsed.fetch_add(names.size());
+            if (offset + names.size() > this->header->arenaSize) {
+                slot->ready.store(2, std::memory_order_release);
+                return;
+            }
+            memcpy(this->arena + offset, names.data(), names.size());
+            slot->offset = offset;
+            slot->length = names.size();
+            slot->ready.store(1, std::memory_order_release);
+            return;
+        }
+    }
+};
+
+// scan cache kept on disk between runs (--cache) as an append-only journal:
+// an 8 byte magic number followed by one record per scanned file, each
+//
+//      uint32 payload length, uint32 crc32 of the payload,
+//      payload: stat signature (5 x uint64), file name '\0', the names it
+//      includes ('\0' terminated)
+//
+// at start up the file is memory mapped and replayed, later records for a
+// file replacing earlier ones; replay stops at the first torn or corrupt
+// record, which is cut off, so a run killed part way through loses only
+// the records it had not yet appended.  a run appends records only for
+// files whose signature changed, and once more than half of the records
+// are dead the live ones are rewritten to a new file that is renamed over
+// the journal, in a background thread while the output is printed
+struct ScanJournal {
+   private:
+    static constexpr const char* MAGIC = "DDJRNL01";
+    static const long COMPACT_MIN_RECORDS = 64;
+
+    struct Entry {
+        uint64_t key[5];
+        std::string names;
+    };
+
+    std::unordered_map<std::string, Entry> entries;
+    std::mutex mutex;
+    std::string path;
+    int fd = -1;
+    long records = 0;  // records in the file, live or dead
+    std::thread compactor;
+
+    static std::string encode(const std::string& file, const uint64_t key[5],
+                              const std::string& names) {
+        std::string record(8, '\0');
+        record.append((const char*)key, 5 * sizeof(uint64_t));
+        record.append(file.c_str(), file.size() + 1);
+        record.append(names);
+        uint32_t header[2];
+        header[0] = record.size() - 8;
+        header[1] = crc32(0, (const Bytef*)record.data() + 8, header[0]);
+        memcpy(&record[0], header, 8);
+        return record;
+    }
+
+    // replay the records in data[0..size), returning the length of the
+    // valid prefix
+    std::size_t replay(const char* data, std::size_t size) {
+        std::size_t pos = 8;
+        while (pos + 8 <= size) {
+            uint32_t header[2];
+            memcpy(header, data + pos, 8);
+            const char* payload = data + pos + 8;
+            if (header[0] < 5 * sizeof(uint64_t) + 1 || header[0] > size - pos - 8 ||
+                crc32(0, (const Bytef*)payload, header[0]) != header[1]) {
+                break;
+            }
+            const char* file = payload + 5 * sizeof(uint64_t);
+            const char* end = payload + header[0];
+            const char* names = (const char*)memchr(file, '\0', end - file);
+            if (names == NULL) {
+                break;
+            }
+            Entry& entry = this->entries[file];
+            memcpy(entry.key, payload, sizeof(entry.key));
+            entry.names.assign(names + 1, end - names - 1);
+            this->records++;
+            pos += 8 + header[0];
+        }
+        return pos;
+    }
+
+    // rewrite the live records to path.tmp and rename it over the journal
+    void compact() {
+        std::string tmp = this->path + ".tmp";
+        int out = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out < 0) {
+            return;
+        }
+        std::string buf(MAGIC);
+        bool ok = true;
+        for (auto& entry : this->entries) {
+            buf += encode(entry.first, entry.second.key, entry.second.names);
+            if (buf.size() >= 1024 * 1024) {
+                ok = ok && write(out, buf.data(), buf.size()) == (ssize_t)buf.size();
+                buf.clear();
+            }
+        }
+        ok = ok && write(out, buf.data(), buf.size()) == (ssize_t)buf.size();
+        ok = fsync(out) == 0 && ok;
+        ok = close(out) == 0 && ok;
+        if (!ok || rename(tmp.c_str(), this->path.c_str()) != 0) {
+            unlink(tmp.c_str());
+        }
+    }
+
+   public:
+    bool isOpen() {
+        return this->fd >= 0;
+    }
+
+    // open the journal at path, creating it if needed, and replay it;
+    // returns false if it can't be opened or isn't a journal
+    bool open(const char* path) {
+        this->path = path;
+        this->fd = ::open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+        struct stat sb;
+        if (this->fd < 0 || fstat(this->fd, &sb) != 0) {
+            return false;
+        }
+        std::size_t size = sb.st_size;
+        if (size == 0) {
+            return write(this->fd, MAGIC, 8) == 8;
+        }
+        void* p = size < 8 ? MAP_FAILED : mmap(NULL, size, PROT_READ, MAP_PRIVATE, this->fd, 0);
+        if (p == MAP_FAILED || memcmp(p, MAGIC, 8) != 0) {
+            if (p != MAP_FAILED) {
+                munmap(p, size);
+            }
+            close(this->fd);
+            this->fd = -1;
+            return false;
+        }
+        std::size_t valid = this->replay((const char*)p, size);
+        munmap(p, size);
+        // cut off a record torn by a crash, so appends follow valid ones
+        return valid == size || ftruncate(this->fd, valid) == 0;
+    }
+
+    // look up file, setting names to the names it includes ('\0'
+    // terminated) if its stat signature is still sb and it was scanned in
+    // mode; returns false on a miss
+    bool find(const char* file, const struct stat& sb, uint64_t mode, std::string* names) {
+        uint64_t key[5];
+        statSignature(sb, mode, key);
+        std::lock_guard<std::mutex> lock(this->mutex);
+        auto it = this->entries.find(file);
+        if (it == this->entries.end() || memcmp(it->second.key, key, sizeof(key)) != 0) {
+            return false;
+        }
+        *names = it->second.names;
+        return true;
+    }
+
+    // record names as the includes of file with stat signature sb, as
+    // scanned in mode, appending a record unless the journal already holds it
+    void record(const char* file, const struct stat& sb, uint64_t mode, const std::string& names) {
+        uint64_t key[5];
+        statSignature(sb, mode, key);
+        std::lock_guard<std::mutex> lock(this->mutex);
+        Entry& entry = this->entries[file];
+        if (memcmp(entry.key, key, sizeof(key)) == 0 && entry.names == names) {
+            return;
+        }
+        std::string record = encode(file, key, names);
+        if (write(this->fd, record.data(), record.size()) != (ssize_t)record.size()) {
+            return;  // a short write is cut off when the journal is replayed
+        }
+        memcpy(entry.key, key, sizeof(key));
+        entry.names = names;
+        this->records++;
+    }
+
+    // compact in the background if more than half the records are dead;
+    // no records may be added after this
+    void startCompaction() {
+        long dead = this->records - this->entries.size();
+        if (this->records >= COMPACT_MIN_RECORDS && dead * 2 > this->records) {
+            this->compactor = std::thread(&ScanJournal::compact, this);
+        }
+    }
+
+    // wait for any compaction, and close the journal
+    void finish() {
+        if (this->compactor.joinable()) {
+            this->compactor.join();
+        }
+        if (this->fd >= 0) {
+            close(this->fd);
+            this->fd = -1;
+        }
+    }
+
+    // an early return from main() still lets a compaction finish (rather
+    // than destroying a joinable thread)
+    ~ScanJournal() {
+        this->finish();
+    }
+};
+
+// targets printed between releases of the mapped spill file
+static const int SPILL_PARTITION_TARGETS = 256;
+
+// dependencies of a file, as the IDs nameInterner gave their names:
+// resident in deps, or once spilled, stored in the spill file at
+// [spillOffset, spillOffset + spillBytes) as a sequence of 4 byte IDs
+struct DepList {
+    std::list<uint32_t> deps;
+    uint32_t id = Interner::NONE;  // of the file itself
+    bool scanned = false;
+    bool imported = false;  // named by a .d file, but not scanned
+    long spillOffset = -1;
+    long spillBytes = 0;
+};
+
+// thread safe map
+struct MapSafe {
+   private:
+    typedef std::unordered_map<PathKey, DepList, PathKeyHash, std::equal_to<PathKey>,
+                               HugePageAllocator<std::pair<const PathKey, DepList>>>
+        Table;
+    Table map;
+    std::vector<DepList*> byId;  // the entries of map, indexed by file ID
+    std::unordered_set<uint32_t> wanted;  // IDs claimed before being inserted
+    std::mutex mutex;
+
+    DepList* add(std::pair<PathKey, std::list<uint32_t>> pair, uint32_t id) {
+        std::size_t buckets = this->map.bucket_count();
+        auto result = this->map.insert({pair.first, DepList()});
+        if (!result.second) {
+            return NULL;
+        }
+        DepList* value = &result.first->second;
+        value->deps = pair.second;
+        value->id = id;
+        std::size_t capacity = this->byId.capacity();
+        if (id >= this->byId.size()) {
+            this->byId.resize(id + 1);
+        }
+        this->byId[id] = value;
+        if (memTracker.isEnabled()) {
+            // node: next pointer, cached hash and the key/value pair
+            memTracker.add(MEM_TABLE, 2 * sizeof(void*) + sizeof(*result.first) +
+                                          (this->map.bucket_count() - buckets) * sizeof(void*) +
+                                          (this->byId.capacity() - capacity) * sizeof(DepList*));
+            memTracker.add(MEM_STRINGS, stringHeapBytes(result.first->first.name));
+            memTracker.add(MEM_EDGES, value->deps.size() * idNodeBytes());
+        }
+        return value;
+    }
+
+   public:
+    // insert the file whose name has key and ID id, with dependencies deps
+    void insert(std::pair<PathKey, std::list<uint32_t>> pair, uint32_t id) {
+        std::unique_lock<std::mutex> lock(mutex);
+        this->add(pair, id);
+    }
+
+    // insert the file whose name has key and ID id, known only from a .d
+    // file, with an empty list; returns true if it has already been
+    // claimed for scanning, and so must be scanned now
+    bool insertImported(const PathKey& key, uint32_t id) {
+        std::unique_lock<std::mutex> lock(mutex);
+        DepList* value = this->add({key, {}}, id);
+        if (value == NULL || this->wanted.erase(id) > 0) {
+            return value != NULL;
+        }
+        value->imported = true;
+        return false;
+    }
+
+    // claim the file with ID id for scanning if it was only known from a .d
+    // file, returning true if so and the caller should queue it
+    bool claimImported(uint32_t id) {
+        std::unique_lock<std::mutex> lock(mutex);
+        DepList* value = id < this->byId.size() ? this->byId[id] : NULL;
+        if (value == NULL) {
+            this->wanted.insert(id);  // not yet inserted
+            return false;
+        }
+        bool imported = value->imported;
+        value->imported = false;
+        return imported;
+    }
+
+    // the dependency list of key, inserted empty if need be, which stays
+    // put as the map grows (unordered_map never moves its nodes); only the
+    // thread that popped key from the workQ appends to it
+    std::list<uint32_t>* getValue(const PathKey& key) {
+        std::unique_lock<std::mutex> lock(mutex);
+        std::size_t buckets = this->map.bucket_count();
+        auto result = this->map.try_emplace(key);
+        if (result.second && memTracker.isEnabled()) {
+            memTracker.add(MEM_TABLE, 2 * sizeof(void*) + sizeof(*result.first) +
+                                          (this->map.bucket_count() - buckets) * sizeof(void*));
+            memTracker.add(MEM_STRINGS, stringHeapBytes(result.first->first.name));
+        }
+        return &result.first->second.deps;
+    }
+
+    // call f with the ID of each dependency of the file with ID id, whether
+    // resident or spilled
+    template <typename F>
+    void forEachDep(uint32_t id, SpillFile* spill, F f) {
+        std::unique_lock<std::mutex> lock(mutex);
+        DepList* value = id < this->byId.size() ? this->byId[id] : NULL;
+        lock.unlock();
+        if (value == NULL) {
+            return;
+        }
+        if (value->spillOffset < 0) {
+            for (uint32_t dep : value->deps) {
+                f(dep);
+            }
+            return;
+        }
+        const char* p = spill->map() + value->spillOffset;
+        for (long i = 0; i < value->spillBytes; i += sizeof(uint32_t)) {
+            uint32_t dep;
+            memcpy(&dep, p + i, sizeof(dep));
+            f(dep);
+        }
+    }
+
+    template <typename F>
+    void forEach(F f) {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (auto& entry : this->map) {
+            f(entry.first, entry.second);
+        }
+    }
+
+    // record that key's dependency list is complete, so it may be spilled
+    void setScanned(const PathKey& key) {
+        std::unique_lock<std::mutex> lock(mutex);
+        this->map[key].scanned = true;
+    }
+
+    // move every complete, resident dependency list into spill, returning
+    // false if the spill file can't be written; the entries themselves (and
+    // the names the interner holds) stay resident
+    bool spillScanned(SpillFile* spill) {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (auto& entry : this->map) {
+            DepList* value = &entry.second;
+            if (!value->scanned || value->spillOffset >= 0 || value->deps.empty()) {
+                continue;
+            }
+            std::string bytes;
+            for (uint32_t dep : value->deps) {
+                bytes.append((const char*)&dep, sizeof(dep));
+            }
+            long offset = spill->append(bytes);
+            if (offset < 0) {
+                return false;
+            }
+            value->spillOffset = offset;
+            value->spillBytes = bytes.size();
+            memTracker.sub(MEM_EDGES, value->deps.size() * idNodeBytes());
+            value->deps.clear();
+        }
+        return true;
+    }
+};
+
+std::vector<std::string> dirs;
+MapSafe theTable;
+QueueSafe workQ;
+Interner nameInterner;
+SpillFile spillFile;
+ShmCache shmCache;
+ScanJournal scanJournal;
+CancelToken cancelToken;
+JobServer jobServer;
+Background background;
+CrawlStats crawlStats;
+ContentCache contentCache;
+// include name of a source -> include names of its dependencies, from the
+// fresh rules of --import-deps files
+std::unordered_map<std::string, std::vector<std::string>> importedDeps;
+// whether files the fast scan may get wrong are rescanned (--tiered)
+bool tieredScan = false;
+// the first error a crawl met
+std::mutex crawlErrorMutex;
+std::string crawlErrorText;
+
+// an error that ends the crawl: it is cancelled and the first message kept,
+// for main() to print (or $(deps) to hand to make) once the crawler threads
+// have unwound and given back their jobserver tokens; the caller carries on
+// as if the crawl had been cancelled
+static void crawlError(const std::string& message) {
+    std::unique_lock<std::mutex> lock(crawlErrorMutex);
+    if (crawlErrorText.empty()) {
+        crawlErrorText = message;
+    }
+    cancelToken.cancel();
+}
+
+// output compression formats (--compress)
+enum CompressFormat { COMPRESS_NONE, COMPRESS_GZIP, COMPRESS_ZSTD };
+
+// thread safe output compressor: output is cut into chunks of CHUNK_SIZE
+// bytes that are compressed in parallel as independent gzip members or zstd
+// frames, and written to fd in order; a concatenation of members or frames
+// decompresses to the concatenated input
+struct OutputCompressor {
+   private:
+    static const std::size_t CHUNK_SIZE = 1024 * 1024;
+
+    CompressFormat format = COMPRESS_NONE;
+    FILE* fd = NULL;
+    std::string chunk;
+    std::vector<std::thread> threads;  // started by the first submit()
+    int nthreads = 0;
+    std::list<std::pair<long, std::string>> jobs;  // sequence number, input
+    std::unordered_map<long, std::string> done;    // sequence number, output
+    long submitted = 0;
+    long written = 0;
+    long maxInFlight = 0;
+    bool closing = false;
+    bool failed = false;
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    bool compress(const std::string& in, std::string* out) {
+        if (this->format == COMPRESS_GZIP) {
+            z_stream zs;
+            memset(&zs, 0, sizeof(zs));
+            // 15 + 16: maximum window, with a gzip header and trailer
+            if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                             Z_DEFAULT_STRATEGY) != Z_OK) {
+                return false;
+            }
+            out->resize(deflateBound(&zs, in.size()) + 32);
+            zs.next_in = (Bytef*)in.data();
+            zs.avail_in = in.size();
+            zs.next_out = (Bytef*)&(*out)[0];
+            zs.avail_out = out->size();
+            int rc = deflate(&zs, Z_FINISH);
+            out->resize(zs.total_out);
+            deflateEnd(&zs);
+            return rc == Z_STREAM_END;
+        }
+#ifdef HAVE_ZSTD
+        if (this->format == COMPRESS_ZSTD) {
+            out->resize(ZSTD_compressBound(in.size()));
+            std::size_t n = ZSTD_compress(&(*out)[0], out->size(), in.data(), in.size(), 3);
+            if (ZSTD_isError(n)) {
+                return false;
+            }
+            out->resize(n);
+            return true;
+        }
+#endif
+        return false;
+    }
+
+    void work() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            while (this->jobs.empty() && !this->closing) {
+                this->cv.wait(lock);
+            }
+            if (this->jobs.empty()) {
+                return;
+            }
+            std::pair<long, std::string> job = std::move(this->jobs.front());
+            this->jobs.pop_front();
+            lock.unlock();
+            std::string out;
+            bool ok = compress(job.second, &out);
+            memTracker.sub(MEM_OUTPUT, CHUNK_SIZE);
+            lock.lock();
+            this->failed = this->failed || !ok;
+            this->done[job.first] = std::move(out);
+            // whichever thread completes the next chunk due writes it, and
+            // any that were waiting behind it
+            auto next = this->done.find(this->written);
+            while (next != this->done.end()) {
+                if (fwrite(next->second.data(), 1, next->second.size(), this->fd) !=
+                    next->second.size()) {
+                    this->failed = true;
+                }
+                this->done.erase(next);
+                next = this->done.find(++this->written);
+            }
+            this->cv.notify_all();
+        }
+    }
+
+    // hand the current chunk to the threads, waiting while too many chunks
+    // are already in flight; the threads are only started here, so a run
+    // that fails before writing output has none to stop
+    void submit() {
+        if (this->threads.empty()) {
+            for (int i = 0; i < this->nthreads; i++) {
+                this->threads.push_back(std::thread([this]() { work(); }));
+            }
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        while (this->submitted - this->written >= this->maxInFlight) {
+            this->cv.wait(lock);
+        }
+        memTracker.add(MEM_OUTPUT, CHUNK_SIZE);
+        this->jobs.push_back({this->submitted++, std::move(this->chunk)});
+        this->chunk.clear();
+        this->chunk.reserve(CHUNK_SIZE);
+        this->cv.notify_all();
+    }
+
+    static ssize_t cookieWrite(void* cookie, const char* buf, size_t size) {
+        OutputCompressor* self = (OutputCompressor*)cookie;
+        std::size_t left = size;
+        while (left > 0) {
+            std::size_t n = std::min(left, CHUNK_SIZE - self->chunk.size());
+            self->chunk.append(buf, n);
+            buf += n;
+            left -= n;
+            if (self->chunk.size() == CHUNK_SIZE) {
+                self->submit();
+            }
+        }
+        return size;
+    }
+
+    static int cookieClose(void* cookie) {
+        return ((OutputCompressor*)cookie)->finish() ? 0 : EOF;
+    }
+
+    // stop the threads once the chunks submitted are written
+    void stop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        this->closing = true;
+        lock.unlock();
+        this->cv.notify_all();
+        for (auto& thread : this->threads) {
+            if (thread.joinable()) {
+                thread.join();
+            }
+        }
+    }
+
+    // compress what's left, wait for every chunk to be written and stop the
+    // threads; returns false if anything failed
+    bool finish() {
+        if (!this->chunk.empty()) {
+            submit();
+        }
+        stop();
+        return !this->failed && fflush(this->fd) == 0;
+    }
+
+   public:
+    // an exit() or return from main() without closing the stream still
+    // stops the threads before the globals they use are destroyed
+    ~OutputCompressor() {
+        this->stop();
+    }
+
+    // returns a stream that compresses into fd using nthreads threads (at
+    // least one, whatever CRAWLER_THREADS says), or NULL if format isn't
+    // supported by this build
+    FILE* open(CompressFormat format, FILE* fd, int nthreads) {
+#ifndef HAVE_ZSTD
+        if (format == COMPRESS_ZSTD) {
+            return NULL;
+        }
+#endif
+        nthreads = std::max(1, nthreads);
+        this->format = format;
+        this->fd = fd;
+        this->maxInFlight = 2 * nthreads;
+        this->chunk.reserve(CHUNK_SIZE);
+        memTracker.add(MEM_OUTPUT, CHUNK_SIZE);
+        this->nthreads = nthreads;
+        cookie_io_functions_t io = {NULL, cookieWrite, NULL, cookieClose};
+        return fopencookie(this, "w", io);
+    }
+};
+
+OutputCompressor outputCompressor;
+
+static void onCancelSignal(int) {
+    cancelToken.cancel();
+}
+
+std::string dirName(const char* c_str) {
+    std::string s = c_str;  // s takes ownership of the string content by allocating memory for it
+    if (s.back() != '/') {
+        s += '/';
+    }
+    return s;
+}
+
+std::pair<std::string, std::string> parseFile(const char* c_file) {
+    std::string file = c_file;
+    std::string::size_type pos = file.rfind('.');
+    if (pos == std::string::npos) {
+        return {file, ""};
+    } else {
+        return {file.substr(0, pos), file.substr(pos + 1)};
+    }
+}
+
+// append the arguments in argv to args, replacing each @file by the
+// arguments in file: separated by whitespace, grouped by single or double
+// quotes, with '\\' escaping the next character; @file arguments within
+// file are expanded in turn, and one that can't be read is kept as it is
+static void expandArguments(int argc, char** argv, std::vector<std::string>* args, int depth = 0) {
+    for (int i = 0; i < argc; i++) {
+        FILE* fd = argv[i][0] == '@' && depth < 16 ? fopen(argv[i] + 1, "r") : NULL;
+        if (fd == NULL) {
+            args->push_back(argv[i]);
+            continue;
+        }
+        std::vector<std::string> words;
+        std::string word;
+        bool inWord = false;
+        char quote = 0;
+        int c;
+        while ((c = getc(fd)) != EOF) {
+            if (c == '\\') {
+                c = getc(fd);
+                if (c == EOF) {
+                    break;
+                }
+                word += c;
+                inWord = true;
+            } else if (quote != 0) {
+                if (c == quote) {
+                    quote = 0;
+                } else {
+                    word += c;
+                }
+            } else if (c == '\'' || c == '"') {
+                quote = c;
+                inWord = true;
+            } else if (isspace(c)) {
+                if (inWord) {
+                    words.push_back(word);
+                    word.clear();
+                    inWord = false;
+                }
+            } else {
+                word += c;
+                inWord = true;
+            }
+        }
+        if (inWord) {
+            words.push_back(word);
+        }
+        fclose(fd);
+        std::vector<char*> wordv;
+        for (auto& w : words) {
+            wordv.push_back(&w[0]);
+        }
+        expandArguments(wordv.size(), wordv.data(), args, depth + 1);
+    }
+}
+
+// call f(target, prerequisites) for each rule with prerequisites in the
+// make rules of the .d file path, as written by the compiler's -MD: names
+// are separated by whitespace, lines continue after a '\' and "\ ", "\#"
+// and "$$" stand for ' ', '#' and '$'.  names are parsed in place in the
+// mapped file, and only those with escapes are copied.  returns false if
+// path can't be read
+template <typename F>
+static bool readDepFile(const char* path, F f) {
+    int fd = open(path, O_RDONLY);
+    struct stat sb;
+    if (fd < 0 || fstat(fd, &sb) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+    if (sb.st_size == 0) {
+        close(fd);
+        return true;
+    }
+    void* map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    const char* p = (const char*)map;
+    const char* end = p + sb.st_size;
+    std::vector<std::pair<const char*, std::size_t>> words;
+    std::list<std::string> unescaped;  // storage for names with escapes
+    std::pair<const char*, std::size_t> target(NULL, 0);
+    auto endRule = [&]() {
+        if (target.first != NULL && !words.empty()) {
+            f(target, words);
+        }
+        target.first = NULL;
+        words.clear();
+        unescaped.clear();
+    };
+    while (p < end) {
+        if (*p == '\\' && p + 1 < end && (p[1] == '\n' || (p[1] == '\r' && p + 2 < end && p[2] == '\n'))) {
+            p += p[1] == '\n' ? 2 : 3;  // continuation
+            continue;
+        }
+        if (*p == '\n') {
+            endRule();
+            p++;
+            continue;
+        }
+        if (*p == ' ' || *p == '\t' || *p == '\r') {
+            p++;
+            continue;
+        }
+        if (*p == '#') {
+            while (p < end && *p != '\n') {
+                p++;
+            }
+            continue;
+        }
+        if (*p == ':' && target.first == NULL) {
+            // the words so far are the targets; make the first the rule's
+            target = words.empty() ? std::make_pair(p, (std::size_t)0) : words[0];
+            words.clear();
+            while (p < end && *p == ':') {
+                p++;
+            }
+            continue;
+        }
+        const char* start = p;
+        bool escaped = false;
+        while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') {
+            if (*p == '\\' && p + 1 < end && (p[1] == ' ' || p[1] == '#')) {
+                escaped = true;
+                p += 2;
+            } else if (*p == '$' && p + 1 < end && p[1] == '$') {
+                escaped = true;
+                p += 2;
+            } else if (*p == '\\' && p + 1 < end && (p[1] == '\n' || p[1] == '\r')) {
+                break;
+            } else if (*p == ':' && target.first == NULL &&
+                       (p + 1 == end || p[1] == ' ' || p[1] == '\t' || p[1] == '\n' || p[1] == '\r' || p[1] == ':')) {
+                break;
+            } else {
+                p++;
+            }
+        }
+        if (!escaped) {
+            words.push_back({start, p - start});
+            continue;
+        }
+        std::string word;
+        for (const char* q = start; q < p; q++) {
+            if ((*q == '\\' && (q[1] == ' ' || q[1] == '#')) || (*q == '$' && q[1] == '$')) {
+                q++;
+            }
+            word.push_back(*q);
+        }
+        unescaped.push_back(word);
+        words.push_back({unescaped.back().data(), unescaped.back().size()});
+    }
+    endRule();
+    munmap(map, sb.st_size);
+    return true;
+}
+
+// whether name, looked up along the search path as openFile() does, finds
+// the file sb describes
+static bool resolvesTo(const std::string& name, const struct stat& sb) {
+    for (auto& dir : dirs) {
+        struct stat found;
+        if (stat((dir + name).c_str(), &found) == 0) {
+            return found.st_dev == sb.st_dev && found.st_ino == sb.st_ino;
+        }
+    }
+    return false;
+}
+
+// the name a file on the search path is included by: path with the -I or
+// CPATH directory it lies under removed, if that name finds path on the
+// search path (with -Iinc, inc/x.h is not x.h while ./x.h exists), or
+// else relative to the current directory; empty for files outside all of
+// them (system headers)
+static std::string includeName(const std::string& path) {
+    struct stat sb;
+    bool exists = stat(path.c_str(), &sb) == 0;
+    for (std::size_t d = 1; d < dirs.size(); d++) {
+        std::string prefix = dirName(dirs[d].c_str());
+        if (path.compare(0, prefix.size(), prefix) == 0 && exists &&
+            resolvesTo(path.substr(prefix.size()), sb)) {
+            return path.substr(prefix.size());
+        }
+    }
+    if (path[0] == '/') {
+        return "";
+    }
+    return path.compare(0, 2, "./") == 0 ? path.substr(2) : path;
+}
+
+// whether the file at path exists and was last modified no later than when
+// the .d file with stat signature dep was written
+static bool olderThan(const std::string& path, const struct stat& dep) {
+    struct stat sb;
+    if (stat(path.c_str(), &sb) != 0) {
+        return false;
+    }
+    return sb.st_mtim.tv_sec < dep.st_mtim.tv_sec ||
+           (sb.st_mtim.tv_sec == dep.st_mtim.tv_sec && sb.st_mtim.tv_nsec <= dep.st_mtim.tv_nsec);
+}
+
+// a path with any leading "./" removed, as sources are keyed in importedDeps
+static std::string sourceKey(const std::string& path) {
+    return path.compare(0, 2, "./") == 0 ? path.substr(2) : path;
+}
+
+// read the .d file path into importedDeps: for each rule whose source and
+// prerequisites are all older than the file, the source's path (as the
+// target argument names it) mapped to the include names of the files it
+// depends on.  returns false if path can't be read
+static bool importDepFile(const char* path) {
+    struct stat dep;
+    if (stat(path, &dep) != 0) {
+        return false;
+    }
+    return readDepFile(path, [&dep](std::pair<const char*, std::size_t>,
+                                    const std::vector<std::pair<const char*, std::size_t>>& words) {
+        std::string source = sourceKey(std::string(words[0].first, words[0].second));
+        std::vector<std::string> deps;
+        for (std::size_t w = 0; w < words.size(); w++) {
+            std::string file(words[w].first, words[w].second);
+            if (!olderThan(file, dep)) {
+                return;  // stale: the source is scanned as usual
+            }
+            std::string name = w > 0 ? includeName(file) : "";
+            if (!name.empty()) {
+                deps.push_back(name);
+            }
+        }
+        importedDeps[source] = deps;
+    });
+}
+
+// a scanner reads a file and appends the names it includes to found, each
+// '\0' terminated; scan returns true if, under --tiered, the file must be
+// rescanned by precise (if there is one) on its whole text.  every scanner
+// shares the crawl, the search path and the scan caches; id tells their
+// results apart for --dedup
+struct Scanner {
+    uint64_t id;
+    bool (*scan)(FILE* fd, std::string* found);
+    void (*precise)(const std::string& text, std::string* found);
+};
+
+// the scanner for each file extension, and for those of source files that
+// may be targets, the suffix that replaces the extension in the target name
+// (foo.c -> foo.o); files with other extensions are scanned as C
+struct ScannerRegistry {
+   private:
+    struct Entry {
+        const Scanner* scanner;
+        const char* targetSuffix;  // NULL if not a source
+    };
+    std::unordered_map<std::string, Entry> entries;
+    const Scanner* fallback = NULL;
+
+   public:
+    void add(const char* extension, const Scanner* scanner, const char* targetSuffix) {
+        this->entries[extension] = {scanner, targetSuffix};
+        if (this->fallback == NULL) {
+            this->fallback = scanner;
+        }
+    }
+
+    const Scanner* find(const char* file) {
+        auto entry = this->entries.find(parseFile(file).second);
+        return entry == this->entries.end() ? this->fallback : entry->second.scanner;
+    }
+
+    // the target of source file, or "" if its extension isn't a source's
+    std::string target(const char* file) {
+        std::pair<std::string, std::string> pair = parseFile(file);
+        auto entry = this->entries.find(pair.second);
+        if (entry == this->entries.end() || entry->second.targetSuffix == NULL) {
+            return "";
+        }
+        return pair.first + entry->second.targetSuffix;
+    }
+
+    // the source extensions, as ".c, .y or .l"
+    std::string sourceExtensions() {
+        std::vector<std::string> exts;
+        for (auto& entry : this->entries) {
+            if (entry.second.targetSuffix != NULL) {
+                exts.push_back("." + entry.first);
+            }
+        }
+        std::sort(exts.begin(), exts.end());
+        std::string list;
+        for (std::size_t i = 0; i < exts.size(); i++) {
+            list += (i == 0 ? "" : i + 1 == exts.size() ? " or " : ", ") + exts[i];
+        }
+        return list;
+    }
+};
+
+ScannerRegistry scanners;
+
+// insert file, with ID fileId, into the table with the dependencies a .d
+// file recorded for it, instead of scanning it; files it depends on that
+// are new to the table are only scanned if a scanned file includes them
+static void importTarget(const PathKey& file, uint32_t fileId, const std::vector<std::string>& names) {
+    std::list<uint32_t> deps;
+    for (auto& name : names) {
+        PathKey key(name);
+        bool added;
+        uint32_t id = nameInterner.intern(key.name.data(), key.name.size(), key.hash, &added);
+        deps.push_back(id);
+        if (added && theTable.insertImported(key, id)) {
+            workQ.push_back(key);
+        }
+    }
+    theTable.insert({file, deps}, fileId);
+    theTable.setScanned(file);
+    crawlStats.imported++;
+}
+
+// add file as a target: steps 3a-c below, appending it to targets; returns
+// false if its extension isn't that of a source with a scanner
+static bool addTarget(const std::string& name, std::vector<std::string>* targets) {
+    std::string target = scanners.target(name.c_str());
+    if (target.empty()) {
+        fprintf(stderr, "Illegal extension: %s - must be %s\n", parseFile(name.c_str()).second.c_str(),
+                scanners.sourceExtensions().c_str());
+        return false;
+    }
+
+    PathKey obj(target);
+    PathKey file(name);
+    bool added;
+    uint32_t objId = nameInterner.intern(obj.name.data(), obj.name.size(), obj.hash, &added);
+    uint32_t fileId = nameInterner.intern(file.name.data(), file.name.size(), file.hash, &added);
+
+    // 3a. insert mapping from file.o to file.ext
+    theTable.insert({obj, {fileId}}, objId);
+
+    // a file named twice, or already included by a file being crawled
+    // (--files-from), is only scanned once
+    if (!added) {
+        if (!importedDeps.empty() && theTable.claimImported(fileId)) {
+            workQ.push_back(file);
+        }
+        targets->push_back(name);
+        return true;
+    }
+
+    // 3b. insert mapping from file.ext to empty list, or when a fresh .d
+    // file recorded them, to its dependencies, which leaves it unscanned
+    auto imported = importedDeps.find(sourceKey(name));
+    if (imported != importedDeps.end()) {
+        importTarget(file, fileId, imported->second);
+        targets->push_back(name);
+        return true;
+    }
+    theTable.insert({file, {}}, fileId);
+
+    // 3c. append file.ext on workQ
+    workQ.push_back(file);
+    targets->push_back(name);
+    return true;
+}
+
+// add each file named in path ('-' for standard input) as a target as soon
+// as it's read; names are separated by newlines or '\0's.  returns 0 once
+// the list is read, 1 if stopped early because the crawl was cancelled, and
+// -1 on error, having cancelled the crawl (this runs beside the crawler
+// threads, so it leaves main() to exit)
+static int readFileList(const char* path, std::vector<std::string>* targets) {
+    int fd = strcmp(path, "-") == 0 ? 0 : open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error opening %s\n", path);
+        cancelToken.cancel();
+        return -1;
+    }
+    bool ok = true;
+    char buf[65536];
+    std::string name;
+    while (!cancelToken.isCancelled()) {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, 50) == 0) {
+            continue;
+        }
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            fprintf(stderr, "Error reading %s\n", path);
+            ok = false;
+        }
+        for (ssize_t i = 0; ok && i < n; i++) {
+            if (buf[i] != '\n' && buf[i] != '\0') {
+                name += buf[i];
+            } else if (!name.empty()) {
+                ok = addTarget(name, targets);
+                name.clear();
+            }
+        }
+        if (n <= 0 || !ok) {
+            break;
+        }
+    }
+    if (fd != 0) {
+        close(fd);
+    }
+    if (ok && !cancelToken.isCancelled() && !name.empty()) {
+        ok = addTarget(name, targets);
+    }
+    if (!ok) {
+        cancelToken.cancel();
+        return -1;
+    }
+    return cancelToken.isCancelled() ? 1 : 0;
+}
+
+// open file using the directory search path constructed in main()
+static FILE* openFile(const char* file) {
+    FILE* fd;
+    for (unsigned int i = 0; i < dirs.size(); i++) {
+        std::string path = dirs[i] + file;
+        fd = fopen(path.c_str(), "r");
+        if (fd != NULL)
+            return fd;  // return the first file that successfully opens
+    }
+    return NULL;
+}
+
+// stat file using the directory search path constructed in main()
+static bool statFile(const char* file, struct stat* sb) {
+    for (unsigned int i = 0; i < dirs.size(); i++) {
+        std::string path = dirs[i] + file;
+        if (stat(path.c_str(), sb) == 0)
+            return true;
+    }
+    return false;
+}
+
+// record that the file being processed includes name: step 4 below
+static void addDependency(const char* name, std::list<uint32_t>* ll) {
+    // 4. append file name's ID to dependency list, hashing it once
+    PathKey key(name);
+    bool added;
+    uint32_t id = nameInterner.intern(key.name.data(), key.name.size(), key.hash, &added);
+    ll->push_back(id);
+    memTracker.add(MEM_EDGES, idNodeBytes());
+    stressDelay();
+    // 4. if file name not already in table (that is, this thread is
+    // the first to intern it) ...
+    if (!added) {
+        // (a name only known from a .d file is still to be scanned)
+        if (!importedDeps.empty() && theTable.claimImported(id)) {
+            workQ.push_back(key);
+        }
+        return;
+    }
+    // ... insert mapping from file name to empty list in table ...
+    theTable.insert({key, {}}, id);
+    stressDelay();
+    // ... append file name to workQ
+    workQ.push_back(key);
+}
+
+// add the names found in file to whichever scan caches are open; each
+// skips names it already holds
+static void cacheScan(const char* file, const struct stat& sb, uint64_t mode, const std::string& names) {
+    if (shmCache.isOpen()) {
+        shmCache.insert(sb, mode, names);
+    }
+    if (scanJournal.isOpen()) {
+        scanJournal.record(file, sb, mode, names);
+    }
+}
+
+// scan text for #include "..." as the preprocessor would, appending each
+// name found to found ('\0' terminated): lines are spliced at a trailing
+// '\', comments and string and character literals are skipped, directives
+// are recognised only at the start of a line (with any spacing after the
+// '#'), and includes in branches of #if/#elif 0 (or after a taken #if/#elif
+// 1) are dropped.  other conditions can't be evaluated without the macros
+// in scope, so their branches are all kept, as the fast scanner does
+static void preciseScan(const std::string& text, std::string* found) {
+    std::string src;
+    src.reserve(text.size());
+    for (std::size_t i = 0; i < text.size(); i++) {
+        if (text[i] == '\\' && text.compare(i + 1, 1, "\n") == 0) {
+            i++;
+        } else if (text[i] == '\\' && text.compare(i + 1, 2, "\r\n") == 0) {
+            i += 2;
+        } else {
+            src.push_back(text[i]);
+        }
+    }
+    std::size_t i = 0, n = src.size();
+    auto isBlank = [&](std::size_t j) {
+        return src[j] == ' ' || src[j] == '\t' || src[j] == '\r' || src[j] == '\f' || src[j] == '\v';
+    };
+    auto skipComment = [&]() {
+        std::size_t end = src.find("*/", i + 2);
+        i = end == std::string::npos ? n : end + 2;
+    };
+    auto skipBlanks = [&]() {
+        while (i < n) {
+            if (isBlank(i)) {
+                i++;
+            } else if (src.compare(i, 2, "/*") == 0) {
+                skipComment();
+            } else {
+                break;
+            }
+        }
+    };
+    // value of a condition that is just a number: 0, 1, or -1 if unknown
+    auto evalCondition = [&]() {
+        skipBlanks();
+        std::size_t start = i;
+        while (i < n && isdigit((unsigned char)src[i])) {
+            i++;
+        }
+        bool number = i > start;
+        long value = number ? strtol(src.c_str() + start, NULL, 10) : 0;
+        skipBlanks();
+        if (!number || (i < n && src[i] != '\n' && src.compare(i, 2, "//") != 0)) {
+            return -1;
+        }
+        return value != 0 ? 1 : 0;
+    };
+
+    struct Cond {
+        bool parentLive;
+        bool taken;  // a branch known to be true was seen
+    };
+    std::vector<Cond> conds;
+    bool live = true;
+    bool lineStart = true;
+    while (i < n) {
+        char c = src[i];
+        if (c == '\n') {
+            lineStart = true;
+            i++;
+        } else if (isBlank(i)) {
+            i++;
+        } else if (src.compare(i, 2, "/*") == 0) {
+            skipComment();
+        } else if (src.compare(i, 2, "//") == 0) {
+            i = std::min(n, src.find('\n', i));
+        } else if (c == '"' || c == '\'') {
+            for (i++; i < n && src[i] != c && src[i] != '\n'; i++) {
+                if (src[i] == '\\') {
+                    i++;
+                }
+            }
+            i++;
+            lineStart = false;
+        } else if (c == '#' && lineStart) {
+            i++;
+            skipBlanks();
+            std::size_t start = i;
+            while (i < n && (isalnum((unsigned char)src[i]) || src[i] == '_')) {
+                i++;
+            }
+            std::string directive = src.substr(start, i - start);
+            if (directive == "include" && live) {
+                skipBlanks();
+                std::size_t end = i < n && src[i] == '"' ? src.find_first_of("\"\n", i + 1) : std::string::npos;
+                if (end != std::string::npos && src[end] == '"') {
+                    found->append(src, i + 1, end - i - 1);
+                    found->push_back('\0');
+                }
+            } else if (directive == "if" || directive == "ifdef" || directive == "ifndef") {
+                int value = directive == "if" ? evalCondition() : -1;
+                conds.push_back({live, value == 1});
+                live = live && value != 0;
+            } else if (directive == "elif" && !conds.empty()) {
+                int value = conds.back().taken ? 0 : evalCondition();
+                conds.back().taken = conds.back().taken || value == 1;
+                live = conds.back().parentLive && value != 0;
+            } else if (directive == "else" && !conds.empty()) {
+                live = conds.back().parentLive && !conds.back().taken;
+            } else if (directive == "endif" && !conds.empty()) {
+                live = conds.back().parentLive;
+                conds.pop_back();
+            }
+            // skip the rest of the directive
+            while (i < n && src[i] != '\n') {
+                if (src.compare(i, 2, "/*") == 0) {
+                    skipComment();
+                } else if (src.compare(i, 2, "//") == 0) {
+                    i = std::min(n, src.find('\n', i));
+                } else {
+                    i++;
+                }
+            }
+        } else {
+            lineStart = false;
+            i++;
+        }
+    }
+}
+
+// copy the name between the quote at p and the next quote (or the end of
+// the line) to found, '\0' terminated
+static void appendQuoted(const char* p, std::string* found) {
+    const char* q = ++p;
+    while (*q != '\0' && *q != '"') {
+        q++;
+    }
+    found->append(p, q - p);
+    found->push_back('\0');
+}
+
+// the fast C scanner (.c, .y, .l, C++ sources and headers): steps 2a and 2b
+// of process(); returns true if, under --tiered, the file must be rescanned
+// by preciseScan()
+static bool scanC(FILE* fd, std::string* found) {
+    char buf[4096];
+    // with --tiered, note conditionals (other than an include guard's
+    // #ifndef, the first directive) and block comments left open at the end
+    // of a line, which the fast scan below gets wrong if they come before
+    // an include
+    bool tricky = false, needsPrecise = false, firstDirective = true;
+    while (fgets(buf, sizeof(buf), fd) != NULL) {
+        char* p = buf;
+        // 2a. skip leading whitespace
+        while (isspace((int)*p)) {
+            p++;
+        }
+        if (tieredScan && !needsPrecise) {
+            if (*p == '#') {
+                char* d = p + 1;
+                while (*d == ' ' || *d == '\t') {
+                    d++;
+                }
+                tricky = tricky || (strncmp(d, "if", 2) == 0 && !(firstDirective && strncmp(d, "ifndef", 6) == 0)) ||
+                         strncmp(d, "el", 2) == 0;
+                needsPrecise = d != p + 1 && strncmp(d, "include", 7) == 0;
+                firstDirective = false;
+            }
+            const char* open = strstr(p, "/*");
+            while (open != NULL && !tricky) {
+                const char* close = strstr(open + 2, "*/");
+                tricky = close == NULL;
+                open = close == NULL ? NULL : strstr(close + 2, "/*");
+            }
+        }
+        // 2b. if match #include
+        if (strncmp(p, "#include", 8) != 0) {
+            continue;
+        }
+        needsPrecise = needsPrecise || tricky;
+        p += 8;  // point to first character past #include
+        // 2bi. skip leading whitespace
+        while (isspace((int)*p)) {
+            p++;
+        }
+        if (*p != '"') {
+            continue;
+        }
+        // 2bii. next character is a ", collect remaining characters of
+        // file name
+        appendQuoted(p, found);
+    }
+    return needsPrecise;
+}
+
+// assembly (.S, .s, .inc): gas ".include "foo.inc"" lines, and #include
+// "foo.h" lines, as .S files go through the C preprocessor
+static bool scanAsm(FILE* fd, std::string* found) {
+    char buf[4096];
+    while (fgets(buf, sizeof(buf), fd) != NULL) {
+        char* p = buf;
+        while (isspace((int)*p)) {
+            p++;
+        }
+        if (strncmp(p, "#include", 8) == 0) {
+            p += 8;
+        } else if (strncmp(p, ".include", 8) == 0) {
+            p += 8;
+        } else {
+            continue;
+        }
+        while (isspace((int)*p)) {
+            p++;
+        }
+        if (*p == '"') {
+            appendQuoted(p, found);
+        }
+    }
+    return false;
+}
+
+// protocol buffers (.proto): import "foo.proto"; lines, including public
+// and weak imports
+static bool scanProto(FILE* fd, std::string* found) {
+    char buf[4096];
+    while (fgets(buf, sizeof(buf), fd) != NULL) {
+        char* p = buf;
+        while (isspace((int)*p)) {
+            p++;
+        }
+        if (strncmp(p, "import", 6) != 0 || !isspace((int)p[6])) {
+            continue;
+        }
+        p += 6;
+        while (isspace((int)*p)) {
+            p++;
+        }
+        for (const char* modifier : {"public", "weak"}) {
+            std::size_t n = strlen(modifier);
+            if (strncmp(p, modifier, n) == 0 && isspace((int)p[n])) {
+                p += n;
+                while (isspace((int)*p)) {
+                    p++;
+                }
+            }
+        }
+        if (*p == '"') {
+            appendQuoted(p, found);
+        }
+    }
+    return false;
+}
+
+static const Scanner C_SCANNER = {0, scanC, preciseScan};
+static const Scanner ASM_SCANNER = {1, scanAsm, NULL};
+static const Scanner PROTO_SCANNER = {2, scanProto, NULL};
+
+// the scanners for each extension known: sources that may be targets, with
+// the suffix of their target, and included files; any other extension
+// (headers, or none) gets the C scanner
+static void registerScanners() {
+    for (const char* ext : {"c", "y", "l", "cc", "cpp", "cxx", "C"}) {
+        scanners.add(ext, &C_SCANNER, ".o");
+    }
+    scanners.add("S", &ASM_SCANNER, ".o");
+    scanners.add("s", &ASM_SCANNER, ".o");
+    scanners.add("inc", &ASM_SCANNER, NULL);
+    scanners.add("proto", &PROTO_SCANNER, ".pb.o");
+}
+
+// process file, looking for the names it includes (#include "foo.h" lines,
+// for C) with the scanner for its extension
+static void process(const char* file, std::list<uint32_t>* ll) {
+    char buf[4096];
+    // 0. with --shm-cache or --cache, reuse the names another scan of the
+    // unchanged file found
+    struct stat sb;
+    bool cacheable = (shmCache.isOpen() || scanJournal.isOpen()) && statFile(file, &sb);
+    std::string found;
+    const Scanner* scanner = scanners.find(file);
+    crawlStats.files++;
+    // the scan caches key results by this scan's mode as well
+    uint64_t mode = scanner->id * 2 + (tieredScan && scanner->precise != NULL);
+    if (cacheable && ((shmCache.isOpen() && shmCache.find(sb, mode, &found)) ||
+                      (scanJournal.isOpen() && scanJournal.find(file, sb, mode, &found)))) {
+        crawlStats.cached++;
+        for (const char* p = found.c_str(); p < found.c_str() + found.size(); p += strlen(p) + 1) {
+            addDependency(p, ll);
+        }
+        cacheScan(file, sb, mode, found);
+        return;
+    }
+    // 1. open the file, once one of the --background read slots is free
+    background.beginRead();
+    FILE* fd = openFile(file);
+    if (fd == NULL) {
+        crawlError("Error opening " + std::string(file));
+        background.endRead();
+        return;
+    }
+    // 1a. with --dedup, read it whole and reuse the names found in a file
+    // with the same contents, or else scan the copy in memory
+    std::string contents;
+    ContentCache::Digest digest = {};
+    if (contentCache.isEnabled()) {
+        std::size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), fd)) > 0) {
+            contents.append(buf, n);
+        }
+        fclose(fd);
+        digest = ContentCache::digest(contents, scanner->id);
+        if (contentCache.find(digest, &found)) {
+            background.endRead();
+            crawlStats.deduped++;
+            crawlStats.dedupBytes += contents.size();
+            for (const char* p = found.c_str(); p < found.c_str() + found.size(); p += strlen(p) + 1) {
+                addDependency(p, ll);
+            }
+            if (cacheable) {
+                cacheScan(file, sb, mode, found);
+            }
+            return;
+        }
+        fd = fmemopen(&contents[0], contents.size(), "r");
+        if (fd == NULL) {
+            crawlError("Error opening " + std::string(file));
+            background.endRead();
+            return;
+        }
+    }
+    // 2. collect the names the scanner finds
+    bool needsPrecise = scanner->scan(fd, &found);
+    crawlStats.bytes += ftell(fd);
+    // 2c. with --tiered, rescan flagged files with the precise lexer, on
+    // the --dedup copy when there is one rather than reading it again
+    if (needsPrecise && scanner->precise != NULL) {
+        found.clear();
+        if (contentCache.isEnabled()) {
+            scanner->precise(contents, &found);
+        } else {
+            std::string text;
+            rewind(fd);
+            std::size_t n;
+            while ((n = fread(buf, 1, sizeof(buf), fd)) > 0) {
+                text.append(buf, n);
+            }
+            scanner->precise(text, &found);
+        }
+        crawlStats.precise++;
+    }
+    // 3. close file
+    fclose(fd);
+    background.endRead();
+    if (contentCache.isEnabled()) {
+        contentCache.insert(digest, found);
+    }
+    // 4. record the names found
+    for (const char* p = found.c_str(); p < found.c_str() + found.size(); p += strlen(p) + 1) {
+        addDependency(p, ll);
+    }
+    if (cacheable) {
+        cacheScan(file, sb, mode, found);
+    }
+}
+
+// iteratively print dependencies: the files in frontier have been printed
+// (or are the target) and are stamped with epoch in printed, and those from
+// position next on have yet to have their dependencies walked
+static void printDependencies(HugeVector<uint32_t>* printed, uint32_t epoch,
+                              std::vector<uint32_t>* frontier, FILE* fd) {
+    if (!printed || !frontier || !fd)
+        return;
+
+    // 1. while there is still a file in the frontier not yet walked
+    for (std::size_t next = 0; next < frontier->size(); next++) {
+        // 2. fetch next file to process
+        uint32_t id = (*frontier)[next];
+        // 3. lookup file in the table, yielding list of dependencies
+        // 4. iterate over dependencies
+        theTable.forEachDep(id, &spillFile, [printed, epoch, frontier, fd](uint32_t dep) {
+            // 4a. if filename is already stamped as printed, continue
+            if ((*printed)[dep] == epoch) {
+                return;
+            }
+            // 4b. print filename, putting it back together from the trie
+            putc(' ', fd);
+            nameInterner.write(dep, fd);
+            // 4c. stamp as printed
+            (*printed)[dep] = epoch;
+            // 4d. append to frontier
+            frontier->push_back(dep);
+        });
+    }
+}
+
+// print throughput and bucket distribution quality of hash over names:
+// quality is the Dragon book measure sum(b(b+1)/2) / ((n/2m)(n+2m-1)) over
+// the m = next power of two >= n buckets selected by the low bits, which is
+// 1.0 for a uniformly random hash and larger the more keys collide
+template <typename H>
+static void printHashReport(const char* label, const std::vector<std::string>& names, H hash,
+                            FILE* fd) {
+    if (names.empty()) {
+        return;
+    }
+    std::vector<uint64_t> hashes;
+    for (auto& name : names) {
+        hashes.push_back(hash(name));
+    }
+    std::size_t rounds = 1 + (1 << 22) / names.size();
+    volatile uint64_t sink = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (std::size_t r = 0; r < rounds; r++) {
+        uint64_t sum = 0;
+        for (auto& name : names) {
+            sum += hash(name);
+        }
+        sink = sink + sum;
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count() /
+                (rounds * names.size());
+
+    std::size_t n = names.size(), m = 1;
+    while (m < n) {
+        m <<= 1;
+    }
+    std::vector<uint32_t> buckets(m);
+    for (uint64_t h : hashes) {
+        buckets[h & (m - 1)]++;
+    }
+    double sum = 0;
+    uint32_t maxBucket = 0;
+    for (uint32_t b : buckets) {
+        sum += b * (b + 1.0) / 2;
+        maxBucket = std::max(maxBucket, b);
+    }
+    double quality = sum / ((n / (2.0 * m)) * (n + 2.0 * m - 1));
+    std::sort(hashes.begin(), hashes.end());
+    long collisions = 0;
+    for (std::size_t i = 1; i < hashes.size(); i++) {
+        collisions += hashes[i] == hashes[i - 1];
+    }
+    fprintf(fd, "hash: %s ns/key=%.2f quality=%.3f maxbucket=%u collisions64=%ld\n", label, ns,
+            quality, maxBucket, collisions);
+}
+
+// write the time per operation of interning every name in names from 1, 2,
+// 4 ... 64 threads at once into an empty Interner, and into an
+// unordered_map behind a mutex, e.g.
+//
+//      intern: threads=8 interner ns/op=21.30 mutex-map ns/op=180.52
+//
+// each thread interns all of the names, starting at a different point, so
+// most operations are lookups of names another thread has added
+static void printInternReport(const std::vector<std::string>& names, FILE* fd) {
+    if (names.empty()) {
+        return;
+    }
+    std::size_t n = names.size();
+    std::vector<uint64_t> hashes;
+    for (auto& name : names) {
+        hashes.push_back(pathHash(name.data(), name.size()));
+    }
+    auto timeThreads = [n](int threads, std::size_t rounds, std::function<void(std::size_t)> op) {
+        auto begin = std::chrono::steady_clock::now();
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; t++) {
+            workers.push_back(std::thread([=]() {
+                for (std::size_t r = 0; r < rounds; r++) {
+                    for (std::size_t k = 0; k < n; k++) {
+                        op((k + t * n / threads) % n);
+                    }
+                }
+            }));
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count() /
+               (threads * rounds * n);
+    };
+    for (int threads = 1; threads <= 64; threads *= 2) {
+        std::size_t rounds = 1 + (1 << 20) / (threads * n);
+        Interner interner;
+        double internerNs = timeThreads(threads, rounds, [&](std::size_t k) {
+            bool added;
+            interner.intern(names[k].data(), names[k].size(), hashes[k], &added);
+        });
+        std::unordered_map<std::string, uint32_t> map;
+        std::mutex mutex;
+        double mapNs = timeThreads(threads, rounds, [&](std::size_t k) {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (map.find(names[k]) == map.end()) {
+                map.insert({names[k], map.size()});
+            }
+        });
+        if (interner.size() != n || map.size() != n) {
+            fprintf(stderr, "Error: interned %u and %zu of %zu names\n", interner.size(), map.size(), n);
+            exit(-1);
+        }
+        fprintf(fd, "intern: threads=%d interner ns/op=%.2f mutex-map ns/op=%.2f\n", threads, internerNs,
+                mapNs);
+    }
+}
+
+// the include names in the transitive dependencies of the file with ID id,
+// found as printDependencies() finds them
+static std::vector<std::string> closureNames(uint32_t id) {
+    std::vector<std::string> names;
+    std::unordered_set<uint32_t> seen = {id};
+    std::vector<uint32_t> frontier = {id};
+    for (std::size_t next = 0; next < frontier.size(); next++) {
+        theTable.forEachDep(frontier[next], &spillFile, [&](uint32_t dep) {
+            if (seen.insert(dep).second) {
+                frontier.push_back(dep);
+                names.push_back(nameInterner.name(dep));
+            }
+        });
+    }
+    return names;
+}
+
+// quote s for /bin/sh
+static std::string shellQuote(const std::string& s) {
+    std::string quoted = "'";
+    for (char c : s) {
+        quoted += c == '\'' ? std::string("'\\''") : std::string(1, c);
+    }
+    return quoted + "'";
+}
+
+// compare the dependencies of up to sample of the .c targets (evenly spread)
+// with those the compiler ($CC, or cc) lists with -MM, run on threads
+// threads at once; for each target that differs, write the files the
+// scanner missed (-) and those it listed but the compiler didn't (+), e.g.
+//
+//      audit foo.o: -config.h +unused.h
+//
+// then a summary, comparing the time per target of the crawl (which took
+// crawlSeconds over all targets) and of the compiler
+static void printAudit(const std::vector<std::string>& targets, long sample, double crawlSeconds,
+                       int threads, FILE* fd) {
+    std::vector<std::string> sources;
+    for (auto& target : targets) {
+        if (parseFile(target.c_str()).second == "c") {
+            sources.push_back(target);
+        }
+    }
+    std::size_t step = std::max<std::size_t>(1, sources.size() / std::max(1L, sample));
+    std::vector<std::string> sampled;
+    for (std::size_t t = 0; t < sources.size() && (long)sampled.size() < sample; t += step) {
+        sampled.push_back(sources[t]);
+    }
+    const char* cc = getenv("CC") != NULL ? getenv("CC") : "cc";
+    std::string flags;
+    for (std::size_t d = 1; d < dirs.size(); d++) {
+        flags += " -I" + shellQuote(dirs[d]);
+    }
+    const char* tmpdir = getenv("TMPDIR");
+
+    // run the compiler on the sample, each of at least one thread taking
+    // the next target (failed is of char, as threads write neighbouring
+    // entries, which a vector<bool> packs into shared words)
+    std::vector<std::vector<std::string>> compiled(sampled.size());
+    std::vector<char> failed(sampled.size());
+    std::atomic<std::size_t> nextTarget{0};
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < std::max(1, threads); t++) {
+        workers.push_back(std::thread([&]() {
+            std::size_t n;
+            while ((n = nextTarget++) < sampled.size()) {
+                std::string path = std::string(tmpdir != NULL ? tmpdir : "/tmp") + "/dependencyDiscoverer.XXXXXX";
+                int tmp = mkstemp(&path[0]);
+                if (tmp < 0) {
+                    failed[n] = true;
+                    continue;
+                }
+                close(tmp);
+                std::string command = std::string(cc) + " -MM -MF " + shellQuote(path) + flags + " " +
+                                      shellQuote(sampled[n]) + " 2>/dev/null";
+                failed[n] = system(command.c_str()) != 0 ||
+                            !readDepFile(path.c_str(), [&](std::pair<const char*, std::size_t>,
+                                                           const std::vector<std::pair<const char*, std::size_t>>& words) {
+                                for (std::size_t w = 1; w < words.size(); w++) {
+                                    std::string name = includeName(std::string(words[w].first, words[w].second));
+                                    if (!name.empty()) {
+                                        compiled[n].push_back(name);
+                                    }
+                                }
+                            });
+                unlink(path.c_str());
+            }
+        }));
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    double compilerSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    long matched = 0, missing = 0, extra = 0, errors = 0;
+    for (std::size_t n = 0; n < sampled.size(); n++) {
+        if (failed[n]) {
+            errors++;
+            continue;
+        }
+        PathKey file(sampled[n]);
+        std::vector<std::string> ours = closureNames(nameInterner.find(file.name.data(), file.name.size(), file.hash));
+        std::vector<std::string>& theirs = compiled[n];
+        std::sort(ours.begin(), ours.end());
+        ours.erase(std::unique(ours.begin(), ours.end()), ours.end());
+        std::sort(theirs.begin(), theirs.end());
+        theirs.erase(std::unique(theirs.begin(), theirs.end()), theirs.end());
+        std::string diff;
+        std::size_t a = 0, b = 0;
+        while (a < ours.size() || b < theirs.size()) {
+            if (b == theirs.size() || (a < ours.size() && ours[a] < theirs[b])) {
+                diff += " +" + ours[a++];
+                extra++;
+            } else if (a == ours.size() || theirs[b] < ours[a]) {
+                diff += " -" + theirs[b++];
+                missing++;
+            } else {
+                a++;
+                b++;
+            }
+        }
+        if (diff.empty()) {
+            matched++;
+        } else {
+            fprintf(fd, "audit %s.o:%s\n", parseFile(sampled[n].c_str()).first.c_str(), diff.c_str());
+        }
+    }
+    long compared = sampled.size() - errors;
+    double ourMs = targets.empty() ? 0 : crawlSeconds * 1000 / targets.size();
+    double theirMs = sampled.empty() ? 0 : compilerSeconds * 1000 / sampled.size();
+    fprintf(fd, "audit: %ld of %zu targets match (%ld failed to compile) missing=%ld extra=%ld "
+            "scanner ms/target=%.3f compiler ms/target=%.3f speedup=%.1fx\n",
+            matched, compared > 0 ? (std::size_t)compared : 0, errors, missing, extra, ourMs, theirMs,
+            ourMs > 0 ? theirMs / ourMs : 0);
+}
+
+// binary snapshot of a crawled dependency graph
+//
+// names are sorted, so a file's ID is its rank; the dependencies of each
+// file are stored as a sorted, duplicate free range of IDs in edges
+// (compressed sparse row form, file n's range is offsets[n]..offsets[n+1]);
+// targets holds the IDs of the foo.o files named on the command line and
+// sizes the size in bytes of each file found on the search path (0 if not)
+struct Snapshot {
+    std::vector<std::string> names;
+    HugeVector<uint32_t> offsets;
+    HugeVector<uint32_t> edges;
+    HugeVector<uint32_t> targets;
+    HugeVector<uint64_t> sizes;
+
+    long bytes() {
+        long n = (this->offsets.capacity() + this->edges.capacity() + this->targets.capacity()) *
+                     sizeof(uint32_t) +
+                 this->sizes.capacity() * sizeof(uint64_t);
+        for (auto& name : this->names) {
+            n += sizeof(std::string) + stringHeapBytes(name);
+        }
+        return n;
+    }
+};
+
+static const char SNAPSHOT_MAGIC[8] = {'D', 'D', 'S', 'N', 'A', 'P', '0', '2'};
+
+// index of name in the sorted names vector (UINT32_MAX if absent)
+static uint32_t snapshotId(const std::vector<std::string>& names, const std::string& name) {
+    auto iter = std::lower_bound(names.begin(), names.end(), name);
+    if (iter == names.end() || *iter != name) {
+        return UINT32_MAX;
+    }
+    return iter - names.begin();
+}
+
+// build a snapshot from theTable, with a target per file in files
+static void buildSnapshot(Snapshot* snap, const std::vector<std::string>& files) {
+    std::vector<std::pair<std::string, uint32_t>> keys;
+    theTable.forEach([&keys](const PathKey& key, const DepList& value) {
+        keys.push_back({key.name, value.id});
+    });
+    std::sort(keys.begin(), keys.end());
+    for (auto& key : keys) {
+        snap->names.push_back(key.first);
+    }
+    snap->offsets.push_back(0);
+    for (auto& key : keys) {
+        struct stat sb;
+        snap->sizes.push_back(statFile(key.first.c_str(), &sb) ? sb.st_size : 0);
+        std::vector<uint32_t> deps;
+        theTable.forEachDep(key.second, &spillFile, [snap, &deps](uint32_t dep) {
+            deps.push_back(snapshotId(snap->names, nameInterner.name(dep)));
+        });
+        std::sort(deps.begin(), deps.end());
+        deps.erase(std::unique(deps.begin(), deps.end()), deps.end());
+        snap->edges.insert(snap->edges.end(), deps.begin(), deps.end());
+        snap->offsets.push_back(snap->edges.size());
+    }
+    for (auto& file : files) {
+        std::string obj = scanners.target(file.c_str());
+        snap->targets.push_back(snapshotId(snap->names, obj));
+    }
+    memTracker.add(MEM_SNAPSHOT, snap->bytes());
+}
+
+template <typename T>
+static bool writeArray(FILE* fd, const HugeVector<T>& v) {
+    uint32_t n = v.size();
+    return fwrite(&n, sizeof(n), 1, fd) == 1 && fwrite(v.data(), sizeof(T), n, fd) == n;
+}
+
+// read n items of size bytes into p, where left bytes of the file remain;
+// the check comes first, so a corrupt count never sizes an allocation
+static bool readItems(FILE* fd, void* p, std::size_t size, uint32_t n, long* left) {
+    if ((unsigned long)n > (unsigned long)*left / size) {
+        return false;
+    }
+    *left -= (long)(size * n);
+    return fread(p, size, n, fd) == n;
+}
+
+template <typename T>
+static bool readArray(FILE* fd, HugeVector<T>* v, long* left) {
+    uint32_t n;
+    if (!readItems(fd, &n, sizeof(n), 1, left) || (unsigned long)n > (unsigned long)*left / sizeof(T)) {
+        return false;
+    }
+    v->resize(n);
+    return readItems(fd, v->data(), sizeof(T), n, left);
+}
+
+// write snap to path, returning false on failure
+static bool writeSnapshot(const Snapshot& snap, const char* path) {
+    FILE* fd = fopen(path, "wb");
+    if (fd == NULL) {
+        return false;
+    }
+    bool ok = fwrite(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC), 1, fd) == 1;
+    uint32_t n = snap.names.size();
+    ok = ok && fwrite(&n, sizeof(n), 1, fd) == 1;
+    for (auto& name : snap.names) {
+        uint32_t len = name.size();
+        ok = ok && fwrite(&len, sizeof(len), 1, fd) == 1 && fwrite(name.data(), 1, len, fd) == len;
+    }
+    ok = ok && writeArray(fd, snap.offsets) && writeArray(fd, snap.edges) &&
+         writeArray(fd, snap.targets) && writeArray(fd, snap.sizes);
+    return fclose(fd) == 0 && ok;
+}
+
+// read snap from path, returning false if it is missing or malformed
+static bool readSnapshot(Snapshot* snap, const char* path) {
+    FILE* fd = fopen(path, "rb");
+    if (fd == NULL) {
+        return false;
+    }
+    // every count and length is checked against the bytes left before
+    // anything is sized by it
+    struct stat sb;
+    long left = fstat(fileno(fd), &sb) == 0 ? sb.st_size : 0;
+    char magic[sizeof(SNAPSHOT_MAGIC)];
+    uint32_t n;
+    bool ok = readItems(fd, magic, sizeof(magic), 1, &left) &&
+              memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) == 0 && readItems(fd, &n, sizeof(n), 1, &left);
+    for (uint32_t i = 0; ok && i < n; i++) {
+        uint32_t len;
+        ok = readItems(fd, &len, sizeof(len), 1, &left) && len <= left;
+        if (ok) {
+            std::string name(len, '\0');
+            ok = readItems(fd, &name[0], 1, len, &left);
+            snap->names.push_back(std::move(name));
+        }
+    }
+    ok = ok && readArray(fd, &snap->offsets, &left) && readArray(fd, &snap->edges, &left) &&
+         readArray(fd, &snap->targets, &left) && readArray(fd, &snap->sizes, &left);
+    fclose(fd);
+    // validate, so later passes can index without checking, and binary
+    // search and merge the names
+    ok = ok && snap->offsets.size() == n + 1 && snap->sizes.size() == n && snap->offsets[0] == 0 &&
+         snap->offsets[n] == snap->edges.size();
+    for (uint32_t i = 1; ok && i < n; i++) {
+        ok = snap->names[i - 1] < snap->names[i];
+    }
+    for (uint32_t i = 0; ok && i < n; i++) {
+        ok = snap->offsets[i] <= snap->offsets[i + 1];
+    }
+    for (uint32_t i = 0; ok && i < snap->edges.size(); i++) {
+        ok = snap->edges[i] < n;
+    }
+    for (uint32_t i = 0; ok && i < snap->targets.size(); i++) {
+        ok = snap->targets[i] < n;
+    }
+    if (ok) {
+        memTracker.add(MEM_SNAPSHOT, snap->bytes());
+    }
+    return ok;
+}
+
+// transitive dependencies of id as a sorted vector of IDs, not including id
+static std::vector<uint32_t> snapshotClosure(const Snapshot& snap, uint32_t id) {
+    std::vector<bool> seen(snap.names.size());
+    std::vector<uint32_t> frontier = {id};
+    std::vector<uint32_t> closure;
+    seen[id] = true;
+    while (!frontier.empty()) {
+        uint32_t next = frontier.back();
+        frontier.pop_back();
+        for (uint32_t e = snap.offsets[next]; e < snap.offsets[next + 1]; e++) {
+            uint32_t dep = snap.edges[e];
+            if (!seen[dep]) {
+                seen[dep] = true;
+                closure.push_back(dep);
+                frontier.push_back(dep);
+            }
+        }
+    }
+    std::sort(closure.begin(), closure.end());
+    return closure;
+}
+
+// a set of file IDs in the style of a roaring bitmap: IDs are split by their
+// high 16 bits into containers, each holding the low 16 bits as a sorted
+// array while there are at most 4096 of them and as a 65536 bit bitmap
+// beyond that, so a set costs at most 2 bytes per ID (8KB per container
+// once dense), unions work a container at a time and iteration is in ID
+// order
+struct RoaringSet {
+   private:
+    static constexpr std::size_t ARRAY_MAX = 4096;
+    static constexpr std::size_t BITMAP_WORDS = 65536 / 64;
+
+    struct Container {
+        uint16_t key;
+        std::vector<uint16_t> array;  // sorted low bits, while sparse
+        std::vector<uint64_t> bits;   // BITMAP_WORDS words, once dense
+    };
+    std::vector<Container> containers;  // sorted by key
+
+    static void toBitmap(Container* c) {
+        c->bits.assign(BITMAP_WORDS, 0);
+        for (uint16_t low : c->array) {
+            c->bits[low >> 6] |= 1ull << (low & 63);
+        }
+        std::vector<uint16_t>().swap(c->array);
+    }
+
+    // the container for key, inserted empty if there is none
+    Container* container(uint16_t key) {
+        auto it = std::lower_bound(this->containers.begin(), this->containers.end(), key,
+                                   [](const Container& c, uint16_t k) { return c.key < k; });
+        if (it == this->containers.end() || it->key != key) {
+            it = this->containers.insert(it, Container{key, {}, {}});
+        }
+        return &*it;
+    }
+
+    static void unionInto(Container* a, const Container& b) {
+        if (a->bits.empty() && b.bits.empty()) {
+            std::vector<uint16_t> merged;
+            merged.reserve(a->array.size() + b.array.size());
+            std::set_union(a->array.begin(), a->array.end(), b.array.begin(), b.array.end(),
+                           std::back_inserter(merged));
+            a->array.swap(merged);
+            if (a->array.size() > ARRAY_MAX) {
+                toBitmap(a);
+            }
+            return;
+        }
+        if (a->bits.empty()) {
+            toBitmap(a);
+        }
+        if (b.bits.empty()) {
+            for (uint16_t low : b.array) {
+                a->bits[low >> 6] |= 1ull << (low & 63);
+            }
+        } else {
+            for (std::size_t w = 0; w < BITMAP_WORDS; w++) {
+                a->bits[w] |= b.bits[w];
+            }
+        }
+    }
+
+   public:
+    void add(uint32_t id) {
+        Container* c = this->container(id >> 16);
+        uint16_t low = id & 0xffff;
+        if (!c->bits.empty()) {
+            c->bits[low >> 6] |= 1ull << (low & 63);
+            return;
+        }
+        auto it = std::lower_bound(c->array.begin(), c->array.end(), low);
+        if (it == c->array.end() || *it != low) {
+            c->array.insert(it, low);
+            if (c->array.size() > ARRAY_MAX) {
+                toBitmap(c);
+            }
+        }
+    }
+
+    void unionWith(const RoaringSet& other) {
+        for (const Container& b : other.containers) {
+            unionInto(this->container(b.key), b);
+        }
+    }
+
+    // call f with every ID in the set, in increasing order
+    template <typename F>
+    void forEach(F f) const {
+        for (const Container& c : this->containers) {
+            uint32_t high = (uint32_t)c.key << 16;
+            if (c.bits.empty()) {
+                for (uint16_t low : c.array) {
+                    f(high | low);
+                }
+                continue;
+            }
+            for (std::size_t w = 0; w < BITMAP_WORDS; w++) {
+                for (uint64_t word = c.bits[w]; word != 0; word &= word - 1) {
+                    f(high | (uint32_t)(w * 64 + __builtin_ctzll(word)));
+                }
+            }
+        }
+    }
+
+    long bytes() const {
+        long n = sizeof(*this) + this->containers.capacity() * sizeof(Container);
+        for (const Container& c : this->containers) {
+            n += c.array.capacity() * sizeof(uint16_t) + c.bits.capacity() * sizeof(uint64_t);
+        }
+        return n;
+    }
+};
+
+// the same operations over a sorted vector of IDs, to compare against
+// RoaringSet in --closure-report
+struct SortedIdSet {
+   private:
+    std::vector<uint32_t> ids;
+
+   public:
+    void add(uint32_t id) {
+        auto it = std::lower_bound(this->ids.begin(), this->ids.end(), id);
+        if (it == this->ids.end() || *it != id) {
+            this->ids.insert(it, id);
+        }
+    }
+
+    void unionWith(const SortedIdSet& other) {
+        std::vector<uint32_t> merged;
+        merged.reserve(this->ids.size() + other.ids.size());
+        std::set_union(this->ids.begin(), this->ids.end(), other.ids.begin(), other.ids.end(),
+                       std::back_inserter(merged));
+        this->ids.swap(merged);
+    }
+
+    template <typename F>
+    void forEach(F f) const {
+        for (uint32_t id : this->ids) {
+            f(id);
+        }
+    }
+
+    long bytes() const {
+        return sizeof(*this) + this->ids.capacity() * sizeof(uint32_t);
+    }
+};
+
+// the transitive closure of every file in a snapshot, kept as one Set per
+// strongly connected component of the include graph (files in an include
+// cycle share a closure)
+//
+// Tarjan's algorithm finishes the components in reverse topological order,
+// so a component's set is built as it finishes: its own files plus the
+// union of the sets of the components its edges lead to, all finished
+// before it
+//
+// unlike FrozenGraph it isn't templated on the index width: a RoaringSet
+// of IDs below 65536 already holds them as 16 bit values in one container,
+// and the component map is only read once per lookup, not walked
+template <typename Set>
+struct ClosureStore {
+   private:
+    std::vector<uint32_t> component;  // file ID -> component
+    std::vector<Set> sets;            // component -> the files it holds and reaches
+
+   public:
+    // build the sets, giving up (and returning false) once they take more
+    // than maxBytes, if maxBytes >= 0
+    bool build(const Snapshot& snap, long maxBytes = -1) {
+        uint32_t n = snap.names.size();
+        long bytes = 0;
+        std::vector<uint32_t> index(n, UINT32_MAX), low(n), unioned(n, UINT32_MAX);
+        std::vector<uint32_t> stack;
+        std::vector<std::pair<uint32_t, uint32_t>> calls;  // file, its next edge
+        std::vector<bool> onStack(n);
+        uint32_t next = 0;
+        this->component.assign(n, UINT32_MAX);
+        this->sets.clear();
+        for (uint32_t root = 0; root < n; root++) {
+            if (index[root] != UINT32_MAX) {
+                continue;
+            }
+            index[root] = low[root] = next++;
+            stack.push_back(root);
+            onStack[root] = true;
+            calls.push_back({root, snap.offsets[root]});
+            while (!calls.empty()) {
+                uint32_t v = calls.back().first;
+                if (calls.back().second < snap.offsets[v + 1]) {
+                    uint32_t w = snap.edges[calls.back().second++];
+                    if (index[w] == UINT32_MAX) {
+                        index[w] = low[w] = next++;
+                        stack.push_back(w);
+                        onStack[w] = true;
+                        calls.push_back({w, snap.offsets[w]});
+                    } else if (onStack[w]) {
+                        low[v] = std::min(low[v], index[w]);
+                    }
+                    continue;
+                }
+                calls.pop_back();
+                if (!calls.empty()) {
+                    uint32_t u = calls.back().first;
+                    low[u] = std::min(low[u], low[v]);
+                }
+                if (low[v] != index[v]) {
+                    continue;
+                }
+                // v roots a component: pop its files (those above v, found
+                // from the top so a deep chain isn't rescanned), then build
+                // its set
+                uint32_t c = this->sets.size();
+                std::size_t first = stack.size() - 1;
+                while (stack[first] != v) {
+                    first--;
+                }
+                for (std::size_t k = first; k < stack.size(); k++) {
+                    this->component[stack[k]] = c;
+                    onStack[stack[k]] = false;
+                }
+                this->sets.emplace_back();
+                Set& set = this->sets.back();
+                for (std::size_t k = first; k < stack.size(); k++) {
+                    uint32_t file = stack[k];
+                    set.add(file);
+                    for (uint32_t e = snap.offsets[file]; e < snap.offsets[file + 1]; e++) {
+                        uint32_t dep = this->component[snap.edges[e]];
+                        if (dep != c && unioned[dep] != c) {
+                            unioned[dep] = c;
+                            set.unionWith(this->sets[dep]);
+                        }
+                    }
+                }
+                stack.resize(first);
+                bytes += set.bytes();
+                if (maxBytes >= 0 && bytes > maxBytes) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // call f with every file reachable from file id (not id itself), in
+    // increasing ID order, as snapshotClosure() finds them
+    template <typename F>
+    void forEach(uint32_t id, F f) const {
+        this->sets[this->component[id]].forEach([id, &f](uint32_t dep) {
+            if (dep != id) {
+                f(dep);
+            }
+        });
+    }
+
+    std::vector<uint32_t> closure(uint32_t id) const {
+        std::vector<uint32_t> ids;
+        this->forEach(id, [&ids](uint32_t dep) { ids.push_back(dep); });
+        return ids;
+    }
+
+    std::size_t components() const {
+        return this->sets.size();
+    }
+
+    long bytes() const {
+        long n = this->component.capacity() * sizeof(uint32_t) +
+                 (this->sets.capacity() - this->sets.size()) * sizeof(Set);
+        for (const Set& set : this->sets) {
+            n += set.bytes();
+        }
+        return n;
+    }
+};
+
+// map a sorted vector of IDs through a monotonic map; the result stays sorted
+static std::vector<uint32_t> remapIds(const std::vector<uint32_t>& ids,
+                                      const HugeVector<uint32_t>& map) {
+    std::vector<uint32_t> out;
+    out.reserve(ids.size());
+    for (uint32_t id : ids) {
+        out.push_back(map[id]);
+    }
+    return out;
+}
+
+// sorted-ID merge of a and b, printing " -name" for IDs only in a and
+// " +name" for IDs only in b; returns the number of differences
+static long printMergeDiff(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b,
+                           const std::vector<std::string>& names, FILE* fd) {
+    long changes = 0;
+    std::size_t i = 0, j = 0;
+    while (i < a.size() || j < b.size()) {
+        if (j == b.size() || (i < a.size() && a[i] < b[j])) {
+            fprintf(fd, " -%s", names[a[i++]].c_str());
+            changes++;
+        } else if (i == a.size() || b[j] < a[i]) {
+            fprintf(fd, " +%s", names[b[j++]].c_str());
+            changes++;
+        } else {
+            i++;
+            j++;
+        }
+    }
+    return changes;
+}
+
+// print the edges and per-target closures that differ between before and
+// after, returning the number of differences
+//
+// both name lists are sorted, so they are merged into one union ID space
+// with monotonic maps; every edge list and closure can then be compared by a
+// linear sorted-ID merge.  the closures of both snapshots are built once, in
+// a ClosureStore of RoaringSets, rather than walked per target
+//
+//      edges foo.h: +bar.h -baz.h
+//      closure foo.o: +bar.h -baz.h
+static long diffSnapshots(const Snapshot& before, const Snapshot& after, FILE* fd) {
+    std::vector<std::string> names;
+    HugeVector<uint32_t> beforeMap(before.names.size()), afterMap(after.names.size());
+    HugeVector<uint32_t> beforeIds, afterIds;  // union ID -> snapshot ID, or UINT32_MAX
+    std::size_t i = 0, j = 0;
+    while (i < before.names.size() || j < after.names.size()) {
+        bool takeBefore = j == after.names.size() ||
+                          (i < before.names.size() && before.names[i] <= after.names[j]);
+        bool takeAfter = i == before.names.size() ||
+                         (j < after.names.size() && after.names[j] <= before.names[i]);
+        uint32_t id = names.size();
+        names.push_back(takeBefore ? before.names[i] : after.names[j]);
+        beforeIds.push_back(takeBefore ? i : UINT32_MAX);
+        afterIds.push_back(takeAfter ? j : UINT32_MAX);
+        if (takeBefore) {
+            beforeMap[i++] = id;
+        }
+        if (takeAfter) {
+            afterMap[j++] = id;
+        }
+    }
+
+    long changes = 0;
+    for (uint32_t id = 0; id < names.size(); id++) {
+        std::vector<uint32_t> a, b;
+        if (beforeIds[id] != UINT32_MAX) {
+            a.assign(before.edges.begin() + before.offsets[beforeIds[id]],
+                     before.edges.begin() + before.offsets[beforeIds[id] + 1]);
+        }
+        if (afterIds[id] != UINT32_MAX) {
+            b.assign(after.edges.begin() + after.offsets[afterIds[id]],
+                     after.edges.begin() + after.offsets[afterIds[id] + 1]);
+        }
+        a = remapIds(a, beforeMap);
+        b = remapIds(b, afterMap);
+        if (a != b) {
+            fprintf(fd, "edges %s:", names[id].c_str());
+            changes += printMergeDiff(a, b, names, fd);
+            fprintf(fd, "\n");
+        }
+    }
+
+    ClosureStore<RoaringSet> beforeClosures, afterClosures;
+    beforeClosures.build(before);
+    afterClosures.build(after);
+    long closureBytes = beforeClosures.bytes() + afterClosures.bytes();
+    memTracker.add(MEM_CLOSURE, closureBytes);
+    std::vector<bool> beforeTarget(names.size()), afterTarget(names.size());
+    for (uint32_t t : before.targets) {
+        beforeTarget[beforeMap[t]] = true;
+    }
+    for (uint32_t t : after.targets) {
+        afterTarget[afterMap[t]] = true;
+    }
+    for (uint32_t t = 0; t < names.size(); t++) {
+        bool inBefore = beforeTarget[t], inAfter = afterTarget[t];
+        if (!inBefore && !inAfter) {
+            continue;
+        }
+        std::vector<uint32_t> a, b;
+        if (inBefore) {
+            a = remapIds(beforeClosures.closure(beforeIds[t]), beforeMap);
+        }
+        if (inAfter) {
+            b = remapIds(afterClosures.closure(afterIds[t]), afterMap);
+        }
+        if (a != b) {
+            fprintf(fd, "closure %s:", names[t].c_str());
+            changes += printMergeDiff(a, b, names, fd);
+            fprintf(fd, "\n");
+        }
+    }
+    memTracker.sub(MEM_CLOSURE, closureBytes);
+    return changes;
+}
+
+// each way of storing closures in --closure-report is given up once it
+// takes more than this (a deep include chain makes every closure large)
+static const long CLOSURE_REPORT_MAX_BYTES = 512L * 1024 * 1024;
+
+// build the closures of every file in snap with Set, then iterate those of
+// every target, printing the time of each and the bytes the closures take
+template <typename Set>
+static void printClosureStore(const char* label, const Snapshot& snap, FILE* fd) {
+    auto start = std::chrono::steady_clock::now();
+    ClosureStore<Set> store;
+    if (!store.build(snap, CLOSURE_REPORT_MAX_BYTES)) {
+        fprintf(fd, "closure: %s skipped: over %ldMB\n", label, CLOSURE_REPORT_MAX_BYTES >> 20);
+        return;
+    }
+    double buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    unsigned long ids = 0;
+    for (uint32_t t : snap.targets) {
+        store.forEach(t, [&ids](uint32_t) { ids++; });
+    }
+    double iterateMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    fprintf(fd, "closure: %s sets=%zu bytes=%ld build ms=%.2f iterate ms=%.2f ids=%lu\n", label,
+            store.components(), store.bytes(), buildMs, iterateMs, ids);
+}
+
+// compare closure storage over snap: a sorted ID vector per target, found by
+// walking the graph from each one, and a ClosureStore of sorted ID vectors
+// and of RoaringSets
+static void printClosureReport(const Snapshot& snap, FILE* fd) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::vector<uint32_t>> closures;
+    long bytes = 0;
+    unsigned long ids = 0;
+    for (uint32_t t : snap.targets) {
+        closures.push_back(snapshotClosure(snap, t));
+        bytes += sizeof(std::vector<uint32_t>) + closures.back().capacity() * sizeof(uint32_t);
+        if (bytes > CLOSURE_REPORT_MAX_BYTES) {
+            break;
+        }
+    }
+    double buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    for (auto& closure : closures) {
+        for (uint32_t id : closure) {
+            ids += id != UINT32_MAX;
+        }
+    }
+    double iterateMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if (bytes > CLOSURE_REPORT_MAX_BYTES) {
+        fprintf(fd, "closure: per-target skipped: over %ldMB\n", CLOSURE_REPORT_MAX_BYTES >> 20);
+    } else {
+        fprintf(fd, "closure: per-target sets=%zu bytes=%ld build ms=%.2f iterate ms=%.2f ids=%lu\n",
+                closures.size(), bytes, buildMs, iterateMs, ids);
+    }
+    closures.clear();
+    closures.shrink_to_fit();
+    printClosureStore<SortedIdSet>("vector", snap, fd);
+    printClosureStore<RoaringSet>("roaring", snap, fd);
+}
+
+// a snapshot's graph frozen for queries, in CSR form in both directions
+// with Index wide file IDs and edge offsets: the node count is fixed once
+// the crawl is over, so most graphs fit 16 bit indexes and halve the cache
+// footprint of walking them (snapshots hold 32 bit IDs, so indexBits()
+// never asks for more; 64 bits is only measured by --width-report)
+template <typename Index>
+struct FrozenGraph {
+    HugeVector<Index> offsets, edges;    // file n includes edges[offsets[n]..offsets[n+1])
+    HugeVector<Index> rOffsets, rEdges;  // file n is included by rEdges[rOffsets[n]..]
+
+    void build(const Snapshot& snap) {
+        std::size_t n = snap.names.size();
+        this->offsets.assign(snap.offsets.begin(), snap.offsets.end());
+        this->edges.assign(snap.edges.begin(), snap.edges.end());
+        this->rOffsets.assign(n + 1, 0);
+        for (Index dep : this->edges) {
+            this->rOffsets[dep + 1]++;
+        }
+        for (std::size_t f = 0; f < n; f++) {
+            this->rOffsets[f + 1] += this->rOffsets[f];
+        }
+        std::vector<Index> next(this->rOffsets.begin(), this->rOffsets.end() - 1);
+        this->rEdges.resize(this->edges.size());
+        for (std::size_t f = 0; f < n; f++) {
+            for (Index e = this->offsets[f]; e < this->offsets[f + 1]; e++) {
+                this->rEdges[next[this->edges[e]]++] = f;
+            }
+        }
+    }
+
+    long bytes() const {
+        return (this->offsets.capacity() + this->edges.capacity() + this->rOffsets.capacity() +
+                this->rEdges.capacity()) *
+               sizeof(Index);
+    }
+
+    // call f with every file reached from seeds (seeds included) along the
+    // edges, or along the reversed edges when reverse is true; stamp[n] ==
+    // epoch marks n as reached, so one stamp array serves many walks
+    template <typename F>
+    void walk(const std::vector<uint32_t>& seeds, bool reverse, HugeVector<uint32_t>* stamp,
+              uint32_t epoch, std::vector<Index>* frontier, F f) const {
+        const HugeVector<Index>& o = reverse ? this->rOffsets : this->offsets;
+        const HugeVector<Index>& e = reverse ? this->rEdges : this->edges;
+        frontier->clear();
+        for (uint32_t seed : seeds) {
+            if ((*stamp)[seed] != epoch) {
+                (*stamp)[seed] = epoch;
+                frontier->push_back(seed);
+            }
+        }
+        while (!frontier->empty()) {
+            Index n = frontier->back();
+            frontier->pop_back();
+            f(n);
+            for (Index k = o[n]; k < o[n + 1]; k++) {
+                if ((*stamp)[e[k]] != epoch) {
+                    (*stamp)[e[k]] = epoch;
+                    frontier->push_back(e[k]);
+                }
+            }
+        }
+    }
+};
+
+// the narrowest index, 16 or 32 bits, that holds snap's file IDs and edge
+// offsets
+static int indexBits(const Snapshot& snap) {
+    return std::max(snap.names.size(), snap.edges.size()) < UINT16_MAX ? 16 : 32;
+}
+
+// freeze snap's graph with Index wide IDs and time the closures of every
+// target and the reverse closures of (up to 10000) files over it
+template <typename Index>
+static void printWidth(const Snapshot& snap, FILE* fd) {
+    FrozenGraph<Index> graph;
+    graph.build(snap);
+    HugeVector<uint32_t> stamp(snap.names.size(), 0);
+    std::vector<Index> frontier;
+    uint32_t epoch = 0;
+    unsigned long closureIds = 0, reverseIds = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t t : snap.targets) {
+        graph.walk({t}, false, &stamp, ++epoch, &frontier, [&closureIds](Index) { closureIds++; });
+    }
+    double closureMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    uint32_t step = std::max<std::size_t>(1, snap.names.size() / 10000);
+    start = std::chrono::steady_clock::now();
+    for (uint32_t n = 0; n < snap.names.size(); n += step) {
+        graph.walk({n}, true, &stamp, ++epoch, &frontier, [&reverseIds](Index) { reverseIds++; });
+    }
+    double reverseMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    fprintf(fd, "width: bits=%zu bytes=%ld closure ms=%.2f ids=%lu reverse ms=%.2f ids=%lu\n",
+            sizeof(Index) * 8, graph.bytes(), closureMs, closureIds, reverseMs, reverseIds);
+}
+
+// compare the graph frozen with 16 (when it fits), 32 and 64 bit IDs
+static void printWidthReport(const Snapshot& snap, FILE* fd) {
+    if (indexBits(snap) == 16) {
+        printWidth<uint16_t>(snap, fd);
+    }
+    printWidth<uint32_t>(snap, fd);
+    printWidth<uint64_t>(snap, fd);
+}
+
+// read "name,cost" lines into weights, keyed by target ID; names may be the
+// target foo.o or its source file, lines that don't parse (e.g. a header)
+// are skipped; returns false if path can't be opened
+static bool readCostWeights(const Snapshot& snap, const char* path, std::vector<double>* weights) {
+    FILE* fd = fopen(path, "r");
+    if (fd == NULL) {
+        return false;
+    }
+    char buf[4096];
+    while (fgets(buf, sizeof(buf), fd) != NULL) {
+        char* comma = strrchr(buf, ',');
+        if (comma == NULL) {
+            continue;
+        }
+        *comma = '\0';
+        char* end;
+        double cost = strtod(comma + 1, &end);
+        if (end == comma + 1) {
+            continue;
+        }
+        // a source stands for its target; any other name (foo.o) is
+        // looked up as it is
+        std::string target = scanners.target(buf);
+        uint32_t id = snapshotId(snap.names, target.empty() ? buf : target);
+        if (id != UINT32_MAX) {
+            (*weights)[id] = cost;
+        }
+    }
+    fclose(fd);
+    return true;
+}
+
+// print the rebuild cost of changed over snap's graph frozen with Index
+// wide IDs (see below)
+template <typename Index>
+static void printRebuildCost(const Snapshot& snap, const std::vector<uint32_t>& changed,
+                             const std::vector<double>* weights, FILE* fd) {
+    FrozenGraph<Index> graph;
+    graph.build(snap);
+    std::vector<bool> isTarget(snap.names.size());
+    for (uint32_t t : snap.targets) {
+        isTarget[t] = true;
+    }
+
+    // target costs are only computed for targets that are reached, by a
+    // walk with its own stamps as it happens in the middle of another.  a
+    // ClosureStore would build the closure of every header too, and those
+    // of a deep include chain take memory quadratic in its length, so a
+    // walk per reached target costs less in practice
+    std::vector<double> cost(snap.names.size(), -1);
+    HugeVector<uint32_t> costStamp(snap.names.size(), 0);
+    std::vector<Index> costFrontier;
+    uint32_t costEpoch = 0;
+    auto targetCost = [&](uint32_t t) {
+        if (cost[t] < 0) {
+            if (weights != NULL) {
+                cost[t] = (*weights)[t];
+            } else {
+                cost[t] = 0;
+                graph.walk({t}, false, &costStamp, ++costEpoch, &costFrontier, [&](Index dep) {
+                    if (dep != t) {
+                        cost[t] += snap.sizes[dep];
+                    }
+                });
+            }
+        }
+        return cost[t];
+    };
+
+    // stamp[n] == epoch marks n as reached in the walk for the epoch'th seed
+    // set, so one array serves the total and every per-file walk
+    HugeVector<uint32_t> stamp(snap.names.size(), 0);
+    std::vector<Index> frontier;
+    uint32_t epoch = 0;
+    auto walk = [&](const std::vector<uint32_t>& seeds, double* total, long* targets) {
+        *total = 0;
+        *targets = 0;
+        graph.walk(seeds, true, &stamp, ++epoch, &frontier, [&](Index n) {
+            if (isTarget[n]) {
+                *total += targetCost(n);
+                (*targets)++;
+            }
+        });
+    };
+    double total;
+    long targets;
+    walk(changed, &total, &targets);
+    fprintf(fd, "rebuild: cost %.0f over %ld of %zu targets\n", total, targets,
+            snap.targets.size());
+
+    std::vector<std::pair<double, uint32_t>> contributions;
+    std::vector<long> counts;
+    for (uint32_t id : changed) {
+        walk({id}, &total, &targets);
+        contributions.push_back({total, counts.size()});
+        counts.push_back(targets);
+    }
+    std::stable_sort(contributions.begin(), contributions.end(),
+                     [](const std::pair<double, uint32_t>& a, const std::pair<double, uint32_t>& b) {
+                         return a.first > b.first;
+                     });
+    for (std::size_t i = 0; i < contributions.size() && i < 10; i++) {
+        uint32_t index = contributions[i].second;
+        fprintf(fd, "changed %s: cost %.0f over %ld targets\n", snap.names[changed[index]].c_str(),
+                contributions[i].first, counts[index]);
+    }
+}
+
+// estimate the cost of rebuilding after the files listed in changes (one
+// per line) are modified; the affected targets are those in the reverse
+// closure of the changed files, each weighted by weights if given, or by
+// the bytes of its transitive dependencies otherwise; the graph is walked
+// with the narrowest IDs that hold it
+//
+//      rebuild: cost 35210 over 23 of 89 targets
+//      changed i_04.h: cost 30211 over 20 targets
+//
+// changed files are listed in order of their own (overlapping) cost, at most
+// ten of them; returns false if changes can't be read
+static bool printRebuildCost(const Snapshot& snap, const char* changes,
+                             const std::vector<double>* weights, FILE* fd) {
+    FILE* in = strcmp(changes, "-") == 0 ? stdin : fopen(changes, "r");
+    if (in == NULL) {
+        return false;
+    }
+    std::vector<uint32_t> changed;
+    char buf[4096];
+    while (fgets(buf, sizeof(buf), in) != NULL) {
+        buf[strcspn(buf, "\r\n")] = '\0';
+        if (buf[0] == '\0') {
+            continue;
+        }
+        uint32_t id = snapshotId(snap.names, buf);
+        if (id == UINT32_MAX) {
+            fprintf(stderr, "Unknown changed file %s\n", buf);
+        } else {
+            changed.push_back(id);
+        }
+    }
+    if (in != stdin) {
+        fclose(in);
+    }
+
+    if (indexBits(snap) == 16) {
+        printRebuildCost<uint16_t>(snap, changed, weights, fd);
+    } else {
+        printRebuildCost<uint32_t>(snap, changed, weights, fd);
+    }
+    return true;
+}
+
+// flush out, finishing any compression; returns false on a write error
+static bool closeOutput(FILE* out) {
+    bool ok = out == stdout ? fflush(out) == 0 : fclose(out) == 0;
+    if (!ok) {
+        fprintf(stderr, "Error writing output\n");
+    }
+    return ok;
+}
+
+// step 4 of main(): scan the files on the workQ, and those they add to it,
+// with number_of_threads threads, returning once it is drained (or the
+// crawl is cancelled)
+static void crawl(int number_of_threads, long memoryBudget) {
+    // init. setup threads, locks and condition variables
+    std::vector<std::thread> threads;
+    ThreadTracker tracker(number_of_threads);
+    for (int i = 0; i < number_of_threads; i++) {
+        threads.push_back(std::thread([tracker = &tracker, memoryBudget, i]() {
+            // 4a. all but the first thread need a jobserver token,
+            // waited for only while there is work left
+            char token;
+            bool holdsToken = false;
+            while (i > 0 && jobServer.isActive() && !holdsToken) {
+                if (cancelToken.isCancelled() || workQ.isDrained()) {
+                    tracker->signal_done();
+                    return;
+                }
+                holdsToken = jobServer.acquire(&token, 50);
+            }
+            while (!cancelToken.isCancelled()) {
+                background.pace(&cancelToken);
+                auto filename = workQ.pop_front_wait(50);
+                if (!filename.name.empty()) {
+                    stressDelay();
+                    // 4b&c. lookup dependencies and invoke 'process'
+                    process(filename.name.c_str(), theTable.getValue(filename));
+                    theTable.setScanned(filename);
+                    workQ.done();
+                    // 4d. spill once over budget, and only once enough
+                    // edges have built up for the pass to pay for itself
+                    if (memoryBudget >= 0 && memTracker.total() > memoryBudget &&
+                        memTracker.bytes(MEM_EDGES) >= memoryBudget / 16 &&
+                        !theTable.spillScanned(&spillFile)) {
+                        crawlError("Error writing spill file");
+                    }
+                } else if (workQ.isDrained()) {
+                    break;
+                }
+            }
+            // 4e. hand the token back as soon as the thread runs dry
+            if (holdsToken) {
+                jobServer.release(token);
+            }
+            tracker->signal_done();
+        }));
+    }
+
+    tracker.wait_done();
+    for (auto& thread : threads) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+}
+
+// step 2 of main(): the search path is the current directory, then the
+// directories of the -Idir arguments among flags, then those in cpath
+static void searchPath(char** flags, int n, const char* cpath) {
+    dirs.push_back(dirName("./"));  // always search current directory first
+    for (int i = 0; i < n; i++) {
+        if (strncmp(flags[i], "-I", 2) == 0) {
+            dirs.push_back(dirName(flags[i] + 2 /* skip -I */));
+        }
+    }
+    if (cpath != NULL) {
+        std::string str(cpath);
+        std::string::size_type last = 0;
+        std::string::size_type next = 0;
+        while ((next = str.find(":", last)) != std::string::npos) {
+            dirs.push_back(str.substr(last, next - last));
+            last = next + 1;
+        }
+        dirs.push_back(str.substr(last));
+    }
+}
+
+#ifdef MAKE_PLUGIN
+// GNU make loadable plugin (built with -DMAKE_PLUGIN, see the Makefile):
+// make refuses to load an object without this symbol
+extern "C" {
+int plugin_is_GPL_compatible;
+}
+
+// the -Idir flags that fixed the search path on the first call of $(deps)
+static std::string pluginFlags;
+static bool pluginReady = false;
+// printed[id] == epoch marks file id as printed by the epoch'th call, so
+// a call only clears the stamps once the epoch wraps around, and only grows
+// the array by the names interned since the last
+static HugeVector<uint32_t> pluginPrinted;
+static uint32_t pluginEpoch = 0;
+
+// stop make with message, as $(error message) does; make exits from there,
+// but NULL is returned in case it comes back
+static char* pluginError(const std::string& message) {
+    std::string text = "$(error ";
+    for (char c : message) {
+        text += c;
+        if (c == '$') {
+            text += '$';
+        }
+    }
+    text += ")";
+    gmk_eval(text.c_str(), NULL);
+    return NULL;
+}
+
+// $(deps files[,flags]): the files the sources in files depend on, as a
+// space separated list without repeats, e.g.
+//
+//      foo.o: $(deps foo.c,-Iinc)
+//
+// the table, interner and search path live as long as make does, so each
+// file is scanned once per make run however many calls name it, and a call
+// only crawls files no earlier call reached; the -Idir flags (then CPATH)
+// fix the search path at the first call, and later calls must give the same
+static char* pluginDeps(const char*, unsigned int argc, char** argv) {
+    // 1. on the first call, assemble the search path
+    std::string flags = argc > 1 ? argv[1] : "";
+    std::vector<std::string> words;
+    if (!pluginReady) {
+        char* word = strtok(&flags[0], " \t\n");
+        for (; word != NULL; word = strtok(NULL, " \t\n")) {
+            words.push_back(word);
+        }
+        std::vector<char*> flagp;
+        for (auto& w : words) {
+            flagp.push_back(&w[0]);
+        }
+        registerScanners();
+        searchPath(flagp.data(), flagp.size(), getenv("CPATH"));
+        pluginFlags = argc > 1 ? argv[1] : "";
+        pluginReady = true;
+    } else if (pluginFlags != (argc > 1 ? argv[1] : "")) {
+        return pluginError("$(deps) flags '" + std::string(argc > 1 ? argv[1] : "") +
+                           "' differ from those of the first call, '" + pluginFlags + "'");
+    }
+
+    // 2. add each source as a target, and crawl what is new on the workQ;
+    // errors go to make rather than ending it from here
+    std::vector<std::string> targets;
+    std::string files = argv[0];
+    char* word = strtok(&files[0], " \t\n");
+    for (; word != NULL; word = strtok(NULL, " \t\n")) {
+        if (scanners.target(word).empty()) {
+            return pluginError("$(deps): illegal extension: " + parseFile(word).second + " - must be " +
+                               scanners.sourceExtensions());
+        }
+        addTarget(word, &targets);
+    }
+    char* crawlerthreads = getenv("CRAWLER_THREADS");
+    crawl(crawlerthreads != NULL ? std::max(1, atoi(crawlerthreads)) : 2, -1);
+    if (!crawlErrorText.empty()) {
+        return pluginError("$(deps): " + crawlErrorText);
+    }
+
+    // 3. print the union of the targets' closures, as step 5 of main()
+    // does one, with a single epoch
+    pluginPrinted.resize(nameInterner.size(), 0);
+    if (++pluginEpoch == 0) {
+        std::fill(pluginPrinted.begin(), pluginPrinted.end(), 0);
+        pluginEpoch = 1;
+    }
+    std::vector<uint32_t> frontier;
+    for (auto& target : targets) {
+        PathKey obj(scanners.target(target.c_str()));
+        uint32_t id = nameInterner.find(obj.name.data(), obj.name.size(), obj.hash);
+        if (pluginPrinted[id] != pluginEpoch) {
+            pluginPrinted[id] = pluginEpoch;
+            frontier.push_back(id);
+        }
+    }
+    char* text = NULL;
+    std::size_t size = 0;
+    FILE* out = open_memstream(&text, &size);
+    if (out == NULL) {
+        return pluginError("$(deps): cannot open its output");
+    }
+    printDependencies(&pluginPrinted, pluginEpoch, &frontier, out);
+    fclose(out);
+
+    // 4. hand make a copy it can free, without the leading space
+    char* result = gmk_alloc(size + 1);
+    const char* start = size > 0 ? text + 1 : text;
+    memcpy(result, start, size - (start - text));
+    result[size - (start - text)] = '\0';
+    free(text);
+    return result;
+}
+
+// called by make's "load dependencyDiscoverer.so" directive
+extern "C" int dependencyDiscoverer_gmk_setup(const gmk_floc*) {
+    gmk_add_function("deps", pluginDeps, 1, 2, GMK_FUNC_DEFAULT);
+    return 1;
+}
+#else
+int main(int argc, char* argv[]) {
+    // expand @file arguments; argv from here on points into args
+    std::vector<std::string> args;
+    expandArguments(argc, argv, &args);
+    std::vector<char*> argp;
+    for (auto& arg : args) {
+        argp.push_back(&arg[0]);
+    }
+    argp.push_back(NULL);
+    argc = args.size();
+    argv = argp.data();
+    registerScanners();
+
+    // 1. look up CPATH in environment
+    char* cpath = getenv("CPATH");
+    char* crawlerthreads = getenv("CRAWLER_THREADS");
+    int number_of_threads;
+    // under a make jobserver, the tokens rather than the default bound the
+    // number of threads that actually run
+    bool underJobServer = jobServer.connect(getenv("MAKEFLAGS"));
+    if (crawlerthreads == NULL) {
+        number_of_threads = underJobServer ? std::max(2u, std::thread::hardware_concurrency()) : 2;
+    } else {
+        number_of_threads = std::stoi(crawlerthreads);
+    }
+
+    // determine the number of option and -Idir arguments
+    bool memoryReport = false;
+    bool hashReport = false;
+    bool internReport = false;
+    bool closureReport = false;
+    bool widthReport = false;
+    bool stats = false;
+    long auditSample = 0;
+    long memoryBudget = -1;
+    const char* snapshotPath = NULL;
+    const char* rebuildPath = NULL;
+    const char* weightsPath = NULL;
+    const char* filesFrom = NULL;
+    CompressFormat compressFormat = COMPRESS_NONE;
+    std::string diffPath;
+    std::vector<const char*> depFiles;
+    std::string loadPath;
+    int i;
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--memory-report") == 0) {
+            memoryReport = true;
+            memTracker.enable();
+        } else if (strncmp(argv[i], "--memory-budget=", 16) == 0) {
+            char* end;
+            long mb = strtol(argv[i] + 16, &end, 10);
+            if (*end != '\0' || end == argv[i] + 16 || mb < 0 || mb > LONG_MAX / (1024 * 1024)) {
+                fprintf(stderr, "Illegal memory budget: %s - must be megabytes\n", argv[i] + 16);
+                return -1;
+            }
+            memoryBudget = mb * 1024 * 1024;
+            memTracker.enable();
+            if (!spillFile.isOpen() && !spillFile.open()) {
+                fprintf(stderr, "Error creating spill file\n");
+                return -1;
+            }
+        } else if (strncmp(argv[i], "--deadline=", 11) == 0) {
+            char* end;
+            long ms = strtol(argv[i] + 11, &end, 10);
+            if (*end != '\0' || end == argv[i] + 11 || ms < 0) {
+                fprintf(stderr, "Illegal deadline: %s - must be milliseconds\n", argv[i] + 11);
+                return -1;
+            }
+            cancelToken.setDeadline(ms);
+        } else if (strncmp(argv[i], "--snapshot=", 11) == 0) {
+            snapshotPath = argv[i] + 11;
+        } else if (strncmp(argv[i], "--diff=", 7) == 0) {
+            diffPath = argv[i] + 7;
+        } else if (strncmp(argv[i], "--huge-pages=", 13) == 0) {
+            if (strcmp(argv[i] + 13, "off") == 0) {
+                hugePageMode = HUGE_PAGES_OFF;
+            } else if (strcmp(argv[i] + 13, "thp") == 0) {
+                hugePageMode = HUGE_PAGES_THP;
+            } else if (strcmp(argv[i] + 13, "hugetlb") == 0) {
+                hugePageMode = HUGE_PAGES_HUGETLB;
+            } else {
+                fprintf(stderr, "Illegal huge page mode: %s - must be off, thp or hugetlb\n",
+                        argv[i] + 13);
+                return -1;
+            }
+        } else if (strncmp(argv[i], "--compress=", 11) == 0) {
+            if (strcmp(argv[i] + 11, "gzip") == 0) {
+                compressFormat = COMPRESS_GZIP;
+            } else if (strcmp(argv[i] + 11, "zstd") == 0) {
+                compressFormat = COMPRESS_ZSTD;
+            } else {
+                fprintf(stderr, "Illegal compression: %s - must be gzip or zstd\n", argv[i] + 11);
+                return -1;
+            }
+        } else if (strncmp(argv[i], "--import-deps=", 14) == 0) {
+            depFiles.push_back(argv[i] + 14);
+        } else if (strncmp(argv[i], "--shm-cache=", 12) == 0) {
+            std::string spec = argv[i] + 12;
+            std::string::size_type comma = spec.find(',');
+            long megabytes = comma == std::string::npos ? 64 : atol(spec.c_str() + comma + 1);
+            spec = spec.substr(0, comma);
+            if (spec[0] != '/' || megabytes <= 0 || !shmCache.open(spec.c_str(), megabytes)) {
+                fprintf(stderr, "Error opening shared memory cache %s\n", spec.c_str());
+                return -1;
+            }
+        } else if (strncmp(argv[i], "--cache=", 8) == 0) {
+            if (!scanJournal.open(argv[i] + 8)) {
+                fprintf(stderr, "Error opening cache %s\n", argv[i] + 8);
+                return -1;
+            }
+        } else if (strncmp(argv[i], "--files-from=", 13) == 0) {
+            filesFrom = argv[i] + 13;
+        } else if (strcmp(argv[i], "--hash-report") == 0) {
+            hashReport = true;
+        } else if (strcmp(argv[i], "--intern-report") == 0) {
+            internReport = true;
+        } else if (strcmp(argv[i], "--closure-report") == 0) {
+            closureReport = true;
+        } else if (strcmp(argv[i], "--width-report") == 0) {
+            widthReport = true;
+        } else if (strncmp(argv[i], "--audit=", 8) == 0) {
+            char* end;
+            auditSample = strtol(argv[i] + 8, &end, 10);
+            if (*end != '\0' || end == argv[i] + 8 || auditSample <= 0) {
+                fprintf(stderr, "Illegal audit sample: %s - must be a positive number\n", argv[i] + 8);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--dedup") == 0) {
+            contentCache.enable();
+        } else if (strcmp(argv[i], "--tiered") == 0) {
+            tieredScan = true;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            stats = true;
+        } else if (strcmp(argv[i], "--background") == 0 || strncmp(argv[i], "--background=", 13) == 0) {
+            char* end;
+            long reads = argv[i][12] == '\0' ? 2 : strtol(argv[i] + 13, &end, 10);
+            if (argv[i][12] != '\0' && (*end != '\0' || end == argv[i] + 13 || reads <= 0)) {
+                fprintf(stderr, "Illegal background reads: %s - must be a positive number\n", argv[i] + 13);
+                return -1;
+            }
+            background.enable(reads);
+        } else if (strncmp(argv[i], "--load=", 7) == 0) {
+            loadPath = argv[i] + 7;
+        } else if (strncmp(argv[i], "--rebuild-cost=", 15) == 0) {
+            rebuildPath = argv[i] + 15;
+        } else if (strncmp(argv[i], "--cost-weights=", 15) == 0) {
+            weightsPath = argv[i] + 15;
+        } else if (strncmp(argv[i], "-I", 2) != 0) {
+            break;
+        }
+    }
+    int start = i;
+    signal(SIGUSR1, onCancelSignal);
+
+    // buffer standard output ourselves so its size can be accounted for
+    static char outputBuffer[64 * 1024];
+    setvbuf(stdout, outputBuffer, _IOFBF, sizeof(outputBuffer));
+    memTracker.add(MEM_OUTPUT, sizeof(outputBuffer));
+
+    // everything written to out goes to standard output, compressed if asked
+    FILE* out = stdout;
+    if (compressFormat != COMPRESS_NONE) {
+        out = outputCompressor.open(compressFormat, stdout, number_of_threads);
+        if (out == NULL) {
+            fprintf(stderr, "Illegal compression: zstd is not supported by this build\n");
+            return -1;
+        }
+        static char compressBuffer[64 * 1024];
+        setvbuf(out, compressBuffer, _IOFBF, sizeof(compressBuffer));
+        memTracker.add(MEM_OUTPUT, sizeof(compressBuffer));
+    }
+
+    // the graph used by --diff and --rebuild-cost is either loaded (--load,
+    // or the second snapshot given to --diff) or taken from the crawl below
+    bool snapshotMode = !diffPath.empty() || rebuildPath != NULL;
+    Snapshot before, after;
+    if (!diffPath.empty()) {
+        std::string::size_type comma = diffPath.find(',');
+        std::string beforePath = diffPath.substr(0, comma);
+        if (!readSnapshot(&before, beforePath.c_str())) {
+            fprintf(stderr, "Error reading snapshot %s\n", beforePath.c_str());
+            return -1;
+        }
+        if (comma != std::string::npos) {
+            loadPath = diffPath.substr(comma + 1);
+        }
+    }
+    if (!loadPath.empty()) {
+        if (!snapshotMode) {
+            fprintf(stderr, "--load requires --diff or --rebuild-cost\n");
+            return -1;
+        }
+        if (!readSnapshot(&after, loadPath.c_str())) {
+            fprintf(stderr, "Error reading snapshot %s\n", loadPath.c_str());
+            return -1;
+        }
+    }
+
+    // 2. assemble dirs vector
+    searchPath(argv + 1, start - 1, cpath);
+
+    for (const char* depFile : depFiles) {
+        if (!importDepFile(depFile)) {
+            fprintf(stderr, "Error opening %s\n", depFile);
+            return -1;
+        }
+    }
+
+    bool incomplete = false;
+    std::vector<std::string> targets;
+    double crawlSeconds = 0;
+    if (loadPath.empty()) {
+        auto crawlStart = std::chrono::steady_clock::now();
+        // 3. for each file argument ...
+        for (i = start; i < argc; i++) {
+            if (!addTarget(argv[i], &targets)) {
+                return -1;
+            }
+        }
+
+        // 3d. ... and each file listed by --files-from, added while the
+        // crawler threads run
+        std::thread reader;
+        int listStatus = 0;
+        if (filesFrom != NULL) {
+            workQ.setOpen(true);
+            reader = std::thread([filesFrom, &targets, &listStatus]() {
+                listStatus = readFileList(filesFrom, &targets);
+                workQ.setOpen(false);
+            });
+        }
+
+        // 4. for each file on the workQ
+        crawl(number_of_threads, memoryBudget);
+        if (reader.joinable()) {
+            reader.join();
+        }
+        if (!crawlErrorText.empty()) {
+            fprintf(stderr, "%s\n", crawlErrorText.c_str());
+            return -1;
+        }
+        if (listStatus < 0) {
+            return -1;
+        }
+        // files left on the workQ were never scanned
+        incomplete = workQ.size() > 0 || listStatus != 0;
+        crawlSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - crawlStart).count();
+        if (scanJournal.isOpen()) {
+            scanJournal.startCompaction();
+        }
+
+        if (hashReport) {
+            std::vector<std::string> names;
+            theTable.forEach([&names](const PathKey& key, const DepList&) {
+                names.push_back(key.name);
+            });
+            printHashReport("std::hash", names, std::hash<std::string>(), stderr);
+            printHashReport("pathHash", names,
+                            [](const std::string& s) { return pathHash(s.data(), s.size()); },
+                            stderr);
+        }
+        if (internReport) {
+            std::vector<std::string> names;
+            for (uint32_t id = 0; id < nameInterner.size(); id++) {
+                names.push_back(nameInterner.name(id));
+            }
+            printInternReport(names, stderr);
+        }
+
+        if (auditSample > 0) {
+            printAudit(targets, auditSample, crawlSeconds, number_of_threads, stderr);
+        }
+
+        if (snapshotPath != NULL || snapshotMode || closureReport || widthReport) {
+            buildSnapshot(&after, targets);
+            if (snapshotPath != NULL && !writeSnapshot(after, snapshotPath)) {
+                fprintf(stderr, "Error writing snapshot %s\n", snapshotPath);
+                return -1;
+            }
+        }
+        if (closureReport) {
+            printClosureReport(after, stderr);
+        }
+        if (widthReport) {
+            printWidthReport(after, stderr);
+        }
+    }
+
+    if (snapshotMode) {
+        long changes = 0;
+        if (!diffPath.empty()) {
+            changes = diffSnapshots(before, after, out);
+        }
+        if (rebuildPath != NULL) {
+            std::vector<double> weights(after.names.size());
+            if (weightsPath != NULL && !readCostWeights(after, weightsPath, &weights)) {
+                fprintf(stderr, "Error opening %s\n", weightsPath);
+                return -1;
+            }
+            if (!printRebuildCost(after, rebuildPath, weightsPath != NULL ? &weights : NULL,
+                                  out)) {
+                fprintf(stderr, "Error opening %s\n", rebuildPath);
+                return -1;
+            }
+        }
+        if (incomplete) {
+            fprintf(out, "# incomplete\n");
+        }
+        scanJournal.finish();
+        if (!closeOutput(out)) {
+            return -1;
+        }
+        if (memoryReport) {
+            memTracker.report(stderr);
+        }
+        if (stats) {
+            crawlStats.report(crawlSeconds, background.yielded(), stderr);
+        }
+        return incomplete ? 2 : changes > 0 ? 1 : 0;
+    }
+
+    // 5. for each file argument, with one array of printed stamps and one
+    // frontier reused by every target: printed[id] == epoch marks file id as
+    // printed for the epoch'th target
+    HugeVector<uint32_t> printed(nameInterner.size(), 0);
+    std::vector<uint32_t> frontier;
+    uint32_t epoch = 0;
+    std::size_t frontierCapacity = 0;
+    memTracker.add(MEM_CLOSURE, printed.size() * sizeof(uint32_t));
+    std::size_t t;
+    for (t = 0; t < targets.size() && !cancelToken.isCancelled(); t++) {
+        // 5a. advance the epoch, so nothing is stamped as printed (clearing
+        // the stamps once the epoch wraps around)
+        if (++epoch == 0) {
+            std::fill(printed.begin(), printed.end(), 0);
+            epoch = 1;
+        }
+        // 5b. empty the frontier of dependencies yet to print
+        frontier.clear();
+
+        PathKey obj(scanners.target(targets[t].c_str()));
+        uint32_t id = nameInterner.find(obj.name.data(), obj.name.size(), obj.hash);
+        // 5c. print "foo.o:" ...
+        fprintf(out, "%s:", obj.name.c_str());
+        // 5c. ... stamp "foo.o" as printed and append to frontier
+        printed[id] = epoch;
+        frontier.push_back(id);
+        // 5d. invoke
+        printDependencies(&printed, epoch, &frontier, out);
+
+        fprintf(out, "\n");
+
+        // 5e. closures are computed in partitions of targets, with spilled
+        // pages dropped from memory between partitions
+        if (spillFile.isOpen() && (t + 1) % SPILL_PARTITION_TARGETS == 0) {
+            spillFile.release();
+        }
+
+        // 5f. the frontier keeps its storage for the next target
+        if (frontier.capacity() != frontierCapacity) {
+            memTracker.add(MEM_CLOSURE, (frontier.capacity() - frontierCapacity) * sizeof(uint32_t));
+            frontierCapacity = frontier.capacity();
+        }
+    }
+    memTracker.sub(MEM_CLOSURE, (printed.size() + frontierCapacity) * sizeof(uint32_t));
+
+    incomplete = incomplete || t < targets.size();
+    if (incomplete) {
+        fprintf(out, "# incomplete\n");
+    }
+    scanJournal.finish();
+    if (!closeOutput(out)) {
+        return -1;
+    }
+    if (memoryReport) {
+        memTracker.report(stderr);
+    }
+    if (stats) {
+        crawlStats.report(crawlSeconds, background.yielded(), stderr);
+    }
+    return incomplete ? 2 : 0;
 }
+#endif
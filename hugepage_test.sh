@@ -0,0 +1,52 @@
+#!/bin/bash
+
+# compare wall time and dTLB misses of the --huge-pages modes on a synthetic
+# tree of $headerNumb headers and $sourceNumb sources; each source includes
+# five random headers and each header includes at most one other, so that
+# closures stay small and the run is dominated by table and array accesses.
+# dTLB misses are only counted if perf is installed
+
+headerNumb=${1:-500000}
+sourceNumb=${2:-50000}
+tree=$(mktemp -d)
+
+awk -v h=$headerNumb -v s=$sourceNumb -v dir=$tree 'BEGIN {
+	srand(1)
+	for (i = 0; i < h; i++) {
+		f = sprintf("%s/i_%d.h", dir, i)
+		if (rand() < 0.5)
+			printf("#include \"i_%d.h\"\n", int(rand() * h)) > f
+		else
+			printf("\n") > f
+		close(f)
+	}
+	for (i = 0; i < s; i++) {
+		f = sprintf("%s/s_%d.c", dir, i)
+		for (j = 0; j < 5; j++)
+			printf("#include \"i_%d.h\"\n", int(rand() * h)) > f
+		close(f)
+	}
+}'
+
+echo "" > hugepage_results.txt
+for mode in off thp hugetlb
+do
+	echo "Huge Pages: $mode" >> hugepage_results.txt
+	echo "Huge Pages: $mode"
+	for (( x=1; x<= 3; x++ ))
+	do
+		if command -v perf > /dev/null
+		then
+			var1=$( (cd $tree && ls | grep '\.c$' | perf stat -x, -e dTLB-load-misses,dTLB-store-misses \
+				$OLDPWD/dependencyDiscoverer --huge-pages=$mode --snapshot=snap --files-from=- 2>&1 1>/dev/null) | cut -d, -f1,3 | tr '\n' ' ')
+		else
+			var1=""
+		fi
+		var2=$( (cd $tree && time (ls | grep '\.c$' | $OLDPWD/dependencyDiscoverer --huge-pages=$mode --snapshot=snap --files-from=- > /dev/null)) 2>&1)
+		echo $var2 $var1 >> hugepage_results.txt
+		echo $var2 $var1
+	done
+	echo
+done
+
+rm -rf $tree
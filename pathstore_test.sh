@@ -0,0 +1,60 @@
+#!/bin/bash
+
+# measure the memory held for file names and the output throughput on a
+# synthetic tree whose include names are long (about 90 bytes) and share
+# directory prefixes: $headerNumb headers spread over four levels of
+# directories below inc/, and $sourceNumb sources including five of them
+# each.  any further arguments name other builds of dependencyDiscoverer to
+# compare against
+
+headerNumb=${1:-50000}
+sourceNumb=${2:-20000}
+shift $(( $# < 2 ? $# : 2 ))
+tree=$(mktemp -d)
+
+awk -v h=$headerNumb -v s=$sourceNumb -v dir=$tree 'BEGIN {
+	srand(1)
+	for (i = 0; i < h; i++) {
+		name[i] = sprintf("project_component_%02d/subsystem_module_%02d/implementation_detail_%02d/header_file_%06d.h",
+			i % 8, int(i / 8) % 16, int(i / 128) % 32, i)
+		d = name[i]
+		sub("/[^/]*$", "", d)
+		if (!(d in made)) {
+			system("mkdir -p " dir "/inc/" d)
+			made[d] = 1
+		}
+	}
+	for (i = 0; i < h; i++) {
+		f = sprintf("%s/inc/%s", dir, name[i])
+		if (rand() < 0.5)
+			printf("#include \"%s\"\n", name[int(rand() * h)]) > f
+		else
+			printf("\n") > f
+		close(f)
+	}
+	for (i = 0; i < s; i++) {
+		f = sprintf("%s/s_%d.c", dir, i)
+		for (j = 0; j < 5; j++)
+			printf("#include \"%s\"\n", name[int(rand() * h)]) > f
+		close(f)
+	}
+}'
+
+echo "" > pathstore_results.txt
+for binary in $PWD/dependencyDiscoverer "$@"
+do
+	echo "Build: $binary" | tee -a pathstore_results.txt
+	for (( x=1; x<= 3; x++ ))
+	do
+		start=$(date +%s.%N)
+		memory=$( (cd $tree && ls | grep '\.c$' | $binary -Iinc --memory-report --files-from=- 2>&1 >out.d) |
+			grep -E 'strings|table|edges|total' | sed 's/memory: //' | tr '\n' ' ')
+		end=$(date +%s.%N)
+		bytes=$(wc -c < $tree/out.d)
+		throughput=$(echo "$bytes $start $end" | awk '{ printf("%.1f MB/s", $1 / ($3 - $2) / 1e6) }')
+		echo "$memory output=$bytes $throughput" | tee -a pathstore_results.txt
+	done
+	echo
+done
+
+rm -rf $tree
@@ -0,0 +1,91 @@
+#!/bin/bash
+
+# crawl $roundNumb randomized synthetic trees (random size, include cycles,
+# headers in -I directories, sources named twice) with a random thread
+# count, random injected scheduling delays and a random crawl option, with
+# the builds made by "make stress": one with delays only and one also under
+# ThreadSanitizer.  each output must equal that of a single threaded crawl
+# by the normal build, and ThreadSanitizer must report nothing; the first
+# failure is kept in stress_results.txt with the tree that caused it
+
+roundNumb=${1:-20}
+maxThreads=${2:-32}
+normal=$PWD/dependencyDiscoverer
+options=("" "--tiered" "--dedup" "--memory-budget=0" "--files-from=list.txt")
+
+echo "" > stress_results.txt
+failures=0
+for (( round=1; round <= $roundNumb; round++ ))
+do
+	tree=$(mktemp -d)
+	seed=$RANDOM
+	awk -v seed=$seed -v dir=$tree 'BEGIN {
+		srand(seed)
+		h = 20 + int(rand() * 2000)
+		s = 1 + int(rand() * 200)
+		system("mkdir -p " dir "/inc/sub")
+		for (i = 0; i < h; i++)
+			name[i] = (i % 3 == 0 ? "sub/" : "") sprintf("h_%d.h", i)
+		for (i = 0; i < h; i++) {
+			f = sprintf("%s/inc/%s", dir, name[i])
+			printf("#ifndef H_%d\n#define H_%d\n", i, i) > f
+			n = int(rand() * 4)
+			for (j = 0; j < n; j++)
+				printf("#include \"%s\"\n", name[int(rand() * h)]) > f
+			printf("#endif\n") > f
+			close(f)
+		}
+		for (i = 0; i < s; i++) {
+			f = sprintf("%s/s_%d.c", dir, i)
+			n = 1 + int(rand() * 6)
+			for (j = 0; j < n; j++)
+				printf("#include \"%s\"\n", name[int(rand() * h)]) > f
+			close(f)
+			printf("s_%d.c\n", i) > (dir "/list.txt")
+			if (rand() < 0.05)
+				printf("s_%d.c\n", i) > (dir "/list.txt")
+		}
+	}'
+	threads=$(( 1 + RANDOM % maxThreads ))
+	jitter=$(( RANDOM % 200 ))
+	option=${options[$(( RANDOM % ${#options[@]} ))]}
+	if [ -z "$option" ] || [ "${option#--files-from}" == "$option" ]
+	then
+		args="$option $(cat $tree/list.txt | tr '\n' ' ')"
+	else
+		args="$option"
+	fi
+	(cd $tree && CRAWLER_THREADS=1 $normal -Iinc $args > reference.d)
+
+	for binary in $PWD/dependencyDiscoverer-stress $PWD/dependencyDiscoverer-tsan
+	do
+		result="ok"
+		(cd $tree && CRAWLER_THREADS=$threads CRAWLER_JITTER_US=$jitter \
+			TSAN_OPTIONS="halt_on_error=1 exitcode=66" \
+			$binary -Iinc $args > out.d 2> err.txt)
+		status=$?
+		if [ $status -ne 0 ] || grep -q ThreadSanitizer $tree/err.txt
+		then
+			result="failed (exit $status)"
+		elif ! cmp -s $tree/out.d $tree/reference.d
+		then
+			result="failed (output differs)"
+		fi
+		line="round $round: seed=$seed threads=$threads jitter=${jitter}us option='$option' $(basename $binary): $result"
+		echo "$line" | tee -a stress_results.txt
+		if [ "$result" != "ok" ]
+		then
+			failures=$(( failures + 1 ))
+			if [ $failures -eq 1 ]
+			then
+				cat $tree/err.txt >> stress_results.txt
+				cp -r $tree stress_failure
+				echo "tree kept in stress_failure/" | tee -a stress_results.txt
+			fi
+		fi
+	done
+	rm -rf $tree
+done
+
+echo "$failures failures in $roundNumb rounds" | tee -a stress_results.txt
+[ $failures -eq 0 ]